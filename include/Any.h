@@ -8,89 +8,236 @@
 #include <iterator>
 #include <iostream>
 #include <string>
+#include <new>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+#include <cassert>
 
 
 #include "any-operators.h"
+#include "AnyAllocator.h"
+#include "Referenced.h"
 
-class AnyMover;
+/// Size in bytes of the buffer embedded into each @c Any instance: values
+/// which fit into it and are nothrow-move-constructible are stored in place
+/// instead of on the heap.
+#ifndef ANY_SMALL_BUFFER_SIZE
+#define ANY_SMALL_BUFFER_SIZE ( 2 * sizeof( void* ) )
+#endif
+
+/// Type checking mode of the throwing accessors and of the comparison
+/// operators: if non zero a @c std::logic_error is thrown on type mismatch,
+/// if zero types are only checked by @c assert. Define to 0 in release builds
+/// which only access values through already validated types.
+#ifndef ANY_CHECK_TYPE
+#define ANY_CHECK_TYPE 1
+#endif
+
+class Any;
+
+/// Type identifier: 64 bit FNV-1a hash of the type name returned by
+/// @c std::type_info::name(), hence identical for the same type in all the
+/// modules of a process, including @c dlopen'ed ones.
+typedef unsigned long long AnyTypeId;
+
+/// Compute type identifier from type name.
+inline AnyTypeId AnyHashTypeName( const char* name )
+{
+    AnyTypeId h = 14695981039346656037ULL;
+    for( ; *name; ++name ) {
+        h ^= static_cast< unsigned char >( *name );
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/// Return identifier of type @c T, computed once per type and module.
+template < class T >
+AnyTypeId AnyTypeIdOf()
+{
+    static const AnyTypeId id = AnyHashTypeName( typeid( T ).name() );
+    return id;
+}
+
+// Namespace scope declarations of the friend templates defined inside Any:
+// required for name lookup when template arguments are explicitly specified.
+template < class ValT > void CheckAnyTypeAndThrow( const Any& );
+template < class AnyT > AnyT* AnyPtr( Any& );
+template < class AnyT > const AnyT* AnyPtr( const Any& );
+template < class AnyT > AnyT& AnyRef( Any& );
+template < class AnyT > const AnyT& AnyRef( const Any& );
+template < class AnyT > AnyT AnyVal( const Any& );
+template < class AnyT > AnyT* AnyCast( Any* );
+template < class AnyT > const AnyT* AnyCast( const Any* ) noexcept;
+
+/// Result of non-throwing type checks.
+enum AnyError {
+    ANY_NO_ERROR = 0,
+    ANY_EMPTY_ERROR,
+    ANY_TYPE_ERROR
+};
+template < class ValT > AnyError AnyCheckType( const Any& ) noexcept;
 
 //------------------------------------------------------------------------------
-/// @brief Class that can hold instances of any type. Uses defaule new/delete
-/// operators.
-/// @todo allow client code to specify allocator
+/// @brief Class that can hold instances of any type. Small values are stored
+/// in an internal buffer of @c ANY_SMALL_BUFFER_SIZE bytes, larger values are
+/// allocated through an @c IAnyAllocator: either the one passed to the
+/// constructor or the current thread's allocator, see @c AnyAllocatorScope.
+/// Copies of heap allocated values use the allocator of the copied value.
+/// Each instance holds a pointer to a static table of operations for the
+/// contained type, followed by the in place data or the pointer to the
+/// heap allocated data.
+/// Values can optionally be shared among copies, see Any::Share().
 /// @ingroup utility
 class Any
 {
-    friend class AnyMover;
+    /// Enable overload for non - @c Any values only.
+    template < class ValT, class R = void >
+    struct EnableIfNotAny : std::enable_if<
+        !std::is_same< typename std::decay< ValT >::type, Any >::value, R > {};
 public:
     /// Type used by Any::Type() method to signal an empty @c Any instance.
     struct EMPTY_ {};
     /// Default constructor, sets the internal pointer to @c NULL
-    Any() : pval_( 0 ) {}
-    /// Constructor accepting a parameter copied into internal type instance.
-    template < class ValT >
-    Any( const ValT& v )
-        : pval_( new ValHandler< ValT >( v ) )
-    {}
-    /// Move constructor
-    Any( const AnyMover& );
+    Any() : ops_( 0 ) {}
+    /// Constructor accepting a parameter copied or moved into internal type
+    /// instance.
+    template < class ValT, class = typename EnableIfNotAny< ValT >::type >
+    Any( ValT&& v ) : ops_( 0 )
+    {
+        Create< typename std::decay< ValT >::type >( 0, std::forward< ValT >( v ) );
+    }
+    /// Constructor accepting a parameter copied or moved into internal type
+    /// instance and the allocator to use if the value does not fit in place.
+    template < class ValT, class = typename EnableIfNotAny< ValT >::type >
+    Any( ValT&& v, IAnyAllocator& a ) : ops_( 0 )
+    {
+        Create< typename std::decay< ValT >::type >( &a, std::forward< ValT >( v ) );
+    }
+    /// Move constructor: @c a is left empty.
+    Any( Any&& a ) noexcept : ops_( 0 ) { MoveFrom( a ); }
     /// Copy constructor.
-    Any( const Any& a ) : pval_( a.pval_ ? a.pval_->Clone() : 0 ) {}
+    Any( const Any& a ) : ops_( 0 )
+    {
+        if( a.ops_ ) a.ops_->clone( a.storage_, storage_ );
+        ops_ = a.ops_;
+    }
     /// Destructor: deletes the contained data type.
-    ~Any() { delete pval_; }
+    ~Any() { if( ops_ ) ops_->destroy( storage_ ); }
 public:
     /// Returns @c true if instance empty.
-    bool Empty() const { return pval_ == 0; }
+    bool Empty() const { return ops_ == 0; }
     /// Returns type of contained data or Any::EMPTY_ if instance empty.
     const std::type_info& Type() const
     {
         //note gcc requires typeid(C) with C != void; compiles on vc++ 2008
-        return !Empty() ? pval_->GetType() : typeid( EMPTY_ ); //
+        return !Empty() ? *ops_->type : typeid( EMPTY_ ); //
+    }
+    /// Returns @c true if contained data is of type @c ValT.
+    template < class ValT > bool Is() const noexcept { return IsType< ValT >(); }
+    /// Returns identifier of contained data type or of Any::EMPTY_ if
+    /// instance empty.
+    AnyTypeId TypeId() const
+    {
+        return !Empty() ? ops_->id() : AnyTypeIdOf< EMPTY_ >();
     }
-    /// Swap two Any instances by swapping the internal pointers.
-    Any& Swap( Any& a ) { std::swap( pval_, a.pval_ ); return *this; }
-    /// Assignment
+    /// Swap two Any instances: internal pointers are swapped when both values
+    /// are heap allocated, in place values are moved.
+    Any& Swap( Any& a )
+    {
+        if( !IsInline() && !a.IsInline() ) {
+            std::swap( ops_, a.ops_ );
+            std::swap( storage_.ref, a.storage_.ref );
+            return *this;
+        }
+        Any tmp;
+        tmp.MoveFrom( a );
+        a.MoveFrom( *this );
+        MoveFrom( tmp );
+        return *this;
+    }
+    /// Assignment: shared values are replaced by a copy of @c a, other
+    /// values are assigned in place if of the same type.
     Any& operator=( const Any& a )
     { 
-        if( pval_ != 0 && a.pval_ != 0 && a.Type() == this->Type() )
+        if( IsTrivialTag( ops_ ) && IsTrivialTag( a.ops_ ) )
+        {
+            ops_ = a.ops_;
+            storage_.buffer = a.storage_.buffer;
+            return *this;
+        }
+        if( ops_ != 0 && !ops_->shared && SameType( ops_, a.ops_ ) )
         {
-            pval_->Assign( *a.pval_ );
+            ops_->assign( storage_, a.Address() );
             return *this;
         }
         Any( a ).Swap( *this ); return *this;
     }
+    /// Move assignment: @c a is left empty.
+    Any& operator=( Any&& a ) noexcept
+    {
+        if( &a == this ) return *this;
+        Release();
+        MoveFrom( a );
+        return *this;
+    }
     /// Assignment from non - @c Any value.
     template < class ValT >
-    Any& operator=( const ValT& v )
+    typename EnableIfNotAny< ValT, Any& >::type operator=( ValT&& v )
     {
-        if( typeid( ValT ) == this->Type() )
+        typedef typename std::decay< ValT >::type T;
+        if( IsType< T >() && !ops_->shared )
         {
-            static_cast< ValHandler<ValT>* >( pval_ )->val_ = v;
+            Data< T >() = std::forward< ValT >( v );
             return *this;
         }
         //CheckAnyTypeAndThrow< ValT >( *this );
-        Any( v ).Swap( *this ); return *this;
+        return *this = Any( std::forward< ValT >( v ) );
     }
+    /// Replace content with an instance of @c T constructed in place from
+    /// @c args; instance is left empty if construction throws.
+    /// @return reference to the newly constructed value
+    template < class T, class... ArgsT >
+    T& Emplace( ArgsT&&... args )
+    {
+        Release();
+        Create< T >( 0, std::forward< ArgsT >( args )... );
+        return Data< T >();
+    }
+    /// Switch to shared mode: the contained value is moved to a reference
+    /// counted block, so that copies of this instance share it and only
+    /// copy it when one of them is accessed through a non-const accessor
+    /// (@c AnyRef, @c AnyPtr, @c AnyAddress, conversion to non-const
+    /// reference). References obtained through non-const accessors are
+    /// shared with copies made afterwards.
+    Any& Share()
+    {
+        if( ops_ ) ops_ = ops_->share( storage_ );
+        return *this;
+    }
+    /// Returns @c true if contained value is in shared mode.
+    bool IsShared() const { return ops_ != 0 && ops_->shared; }
     /// Equality: check by converting value to contained value type then
     /// invoking equality operator on converted type.
     template < class ValT >
     bool operator==( const ValT& v ) const
     {
         CheckAndThrow< ValT >();
-        return ( static_cast< ValHandler<ValT>* >( pval_ )->val_ ) == v;
+        return Data< ValT >() == v;
     }
 public:
     ///Convert to const reference.
     template < class ValT > operator const ValT&() const
     {
         CheckAndThrow< ValT >();
-        return ( static_cast< ValHandler<ValT>* >( pval_ )->val_ );
+        return Data< ValT >();
     }
     ///Convert to reference.
     template < class ValT > operator ValT&() const
     {
         CheckAndThrow< ValT >();
-        return ( static_cast< ValHandler<ValT>* >( pval_ )->val_ );
+        return MutableData< ValT >();
     }
 
     ///Overloaded reference operator: required when a reference to Any
@@ -113,14 +260,16 @@ public:
     template < class ValT >
     friend void CheckAnyTypeAndThrow( const Any& any )
     {
-//#ifdef ANY_CHECK_TYPE
-        if( typeid( ValT ) != any.Type() )
+#if ANY_CHECK_TYPE
+        if( !any.IsType< ValT >() )
             throw std::logic_error( 
                     ( std::string( " Attempt to convert from ")
                     + any.Type().name()
                     + std::string( " to " )
                     + typeid( ValT ).name() ).c_str() );
-//#endif
+#else
+        assert( any.IsType< ValT >() );
+#endif
     }
     /// Check if contained data is convertible to specific type.
     /// @note although this function does not use any private data
@@ -131,95 +280,164 @@ public:
     ///   other inline friends cannot invoke it
     friend void CheckAnyTypeAndThrow( const Any& any1, const Any& any2 )
     {
-//#ifdef ANY_CHECK_TYPE
-        if( any1.Type() != any2.Type() )
+#if ANY_CHECK_TYPE
+        if( !SameType( any1.ops_, any2.ops_ ) )
             throw std::logic_error( 
                     ( std::string( " Attempt to convert between ")
                     + any1.Type().name()
                     + std::string( " and " )
                     + any2.Type().name() ).c_str() );
-//#endif
+#else
+        assert( SameType( any1.ops_, any2.ops_ ) );
+#endif
+    }
+    /// Non-throwing type check.
+    /// @return ANY_EMPTY_ERROR if instance empty, ANY_TYPE_ERROR if contained
+    /// data not of type @c ValT, ANY_NO_ERROR otherwise
+    template < class ValT >
+    friend AnyError AnyCheckType( const Any& any ) noexcept
+    {
+        if( any.Empty() ) return ANY_EMPTY_ERROR;
+        return any.IsType< ValT >() ? ANY_NO_ERROR : ANY_TYPE_ERROR;
     }
     
 
     /// Return size of contained data.
     friend size_t AnySizeOf( const Any& any )
     {
-        return any.pval_->SizeofData();
+        return any.ops_->size;
+    }
+    /// Return @c true if contained data is trivially copyable: the
+    /// AnySizeOf bytes at AnyAddress can be copied with @c memcpy.
+    friend bool AnyIsTriviallyCopyable( const Any& any )
+    {
+        return any.ops_ != 0 && any.ops_->trivial;
     }
     ///Give access to address of contained data.
     friend void* AnyAddress( Any& any )
     {
-        return any.pval_->GetDataAddress();
+        any.Detach();
+        return any.Address();
     }
     ///Get alignment of contained data.
     friend size_t AnyAlignment( Any& any )
     {
-        return any.pval_->GetAlignment();
+        return any.ops_->alignment;
     }
     ///Give access to address of contained data.
     friend const void* AnyAddress( const Any& any )
     {
-        return any.pval_->GetDataAddress();
+        return any.Address();
     }
     /// Give access to address of contained data.
     template < class AnyT >
     friend AnyT* AnyPtr( Any& any )
     {
         CheckAnyTypeAndThrow< AnyT >( any );
-        return ( &static_cast< Any::ValHandler<AnyT>* >( any.pval_ )->val_ );
+        return &any.MutableData< AnyT >();
     }
     /// Give access to address of contained const data.
     template < class AnyT >
     friend const AnyT* AnyPtr( const Any& any )
     {
         CheckAnyTypeAndThrow< AnyT >( any );
-        return ( &static_cast< Any::ValHandler<AnyT>* >( any.pval_ )->val_ );
+        return &any.Data< AnyT >();
     }
     /// Give access to reference to contained data.
     template < class AnyT >
     friend AnyT& AnyRef( Any& any )
     {
         CheckAnyTypeAndThrow< AnyT >( any );
-        return ( static_cast< Any::ValHandler<AnyT>* >( any.pval_ )->val_ );
+        return any.MutableData< AnyT >();
     }
     /// Give access to const reference to contained data.
     template < class AnyT >
     friend const AnyT& AnyRef( const Any& any )
     {
         CheckAnyTypeAndThrow< AnyT >( any );
-        return ( static_cast< Any::ValHandler<AnyT>* >( any.pval_ )->val_ );
+        return any.Data< AnyT >();
     }
     /// Return value.
     template < class AnyT >
     friend AnyT AnyVal( const Any& any )
     {
         CheckAnyTypeAndThrow< AnyT >( any );
-        return ( static_cast< Any::ValHandler<AnyT>* >( any.pval_ )->val_ );
+        return any.Data< AnyT >();
+    }
+    /// Give access to address of contained data, @c NULL if @c any is
+    /// @c NULL, empty or not holding data of type @c AnyT. Does not throw
+    /// on type mismatch: use to probe for different types. A shared value
+    /// is detached first, like with AnyRef, which copies it and can throw
+    /// what the allocation or the copy throws; use the const overload to
+    /// probe without copying.
+    template < class AnyT >
+    friend AnyT* AnyCast( Any* any )
+    {
+        return any && any->IsType< AnyT >() ? &any->MutableData< AnyT >() : 0;
+    }
+    /// Give access to address of contained const data, @c NULL if @c any is
+    /// @c NULL, empty or not holding data of type @c AnyT.
+    template < class AnyT >
+    friend const AnyT* AnyCast( const Any* any ) noexcept
+    {
+        return any && any->IsType< AnyT >() ? &any->Data< AnyT >() : 0;
     }
     /// Less than operator
     bool friend operator<( const Any& a1, const Any& a2 ) {
+        int r;
+        if( TaggedCompare( a1, a2, r ) ) return r < 0;
         CheckAnyTypeAndThrow( a1, a2 );
         if( a1.Empty() ) throw std::logic_error( "Attempt to compare empty values" );
-        return a1.pval_->LessThan( a2.pval_->GetDataAddress() );
+        return a1.ops_->less( a1.Address(), a2.Address() );
     }
     /// Greater than operator
     bool friend operator>( const Any& a1, const Any& a2 ) {
+        int r;
+        if( TaggedCompare( a1, a2, r ) ) return r > 0;
+        CheckAnyTypeAndThrow( a1, a2 );
+        if( a1.Empty() ) throw std::logic_error( "Attempt to compare empty values" );
+        return a1.ops_->less( a2.Address(), a1.Address() );
+    }
+    /// Three-way comparison: negative if @c a1 < @c a2, zero if
+    /// equivalent, positive if @c a1 > @c a2; performs a single type check
+    /// and a single call to the @c AnyCompare overload of the contained type.
+    friend int AnyCompare( const Any& a1, const Any& a2 ) {
+        int r;
+        if( TaggedCompare( a1, a2, r ) ) return r;
         CheckAnyTypeAndThrow( a1, a2 );
         if( a1.Empty() ) throw std::logic_error( "Attempt to compare empty values" );
-        return a2.pval_->LessThan( a1.pval_->GetDataAddress() );
+        return a1.ops_->compare( a1.Address(), a2.Address() );
     }
     /// Equality operator
     bool friend operator==( const Any& a1, const Any& a2 ) {
+        bool r;
+        if( TaggedEqual( a1, a2, r ) ) return r;
         CheckAnyTypeAndThrow( a1, a2 );
         if( a1.Empty() ) throw std::logic_error( "Attempt to compare empty values" );
-        return a1.pval_->EqualTo( a2.pval_->GetDataAddress() );
+        return a1.ops_->equal( a1.Address(), a2.Address() );
     }
     /// Inequality operator
     bool friend operator!=( const Any& a1, const Any& a2 ) {
+        bool r;
+        if( TaggedEqual( a1, a2, r ) ) return !r;
         CheckAnyTypeAndThrow( a1, a2 );
         if( a1.Empty() ) throw std::logic_error( "Attempt to compare empty values" );
-        return !a1.pval_->EqualTo( a2.pval_->GetDataAddress() );
+        return !a1.ops_->equal( a1.Address(), a2.Address() );
+    }
+    /// Non-throwing equality: @c true if both instances are empty or hold
+    /// values of the same type which are equal according to @c AnyEqual;
+    /// values of different types are not equivalent.
+    friend bool AnyEquivalent( const Any& a1, const Any& a2 )
+    {
+        if( !SameType( a1.ops_, a2.ops_ ) ) return false;
+        return a1.Empty() || a1.ops_->equal( a1.Address(), a2.Address() );
+    }
+    /// Hash of contained value computed by the @c AnyHash overload for its
+    /// type, zero if instance empty; values equal according to @c operator==
+    /// have the same hash.
+    friend size_t AnyHash( const Any& any )
+    {
+        return any.Empty() ? 0 : any.ops_->hash( any.Address() );
     }
 
 private:
@@ -228,124 +446,552 @@ private:
     {
         CheckAnyTypeAndThrow< ValT >( *this );
     }
+    /// Return @c true if contained data is stored in the internal buffer.
+    bool IsInline() const
+    {
+        return ops_ != 0 && ops_->inplace;
+    }
+    /// Destroy contained data and leave instance empty.
+    void Release() noexcept
+    {
+        if( ops_ ) ops_->destroy( storage_ );
+        ops_ = 0;
+    }
+    /// Take ownership of the data contained in @c a, which is left empty;
+    /// @c this must be empty.
+    void MoveFrom( Any& a ) noexcept
+    {
+        if( a.ops_ ) a.ops_->move( a.storage_, storage_ );
+        ops_ = a.ops_;
+        a.ops_ = 0;
+    }
+
+    /// Storage for in place data.
+    typedef std::aligned_storage< ANY_SMALL_BUFFER_SIZE,
+                                  std::alignment_of< void* >::value >::type Buffer;
+
+    /// Reference to data stored out of place.
+    struct Ref
+    {
+        /// Address of data.
+        void* data;
+        /// Address of block containing data.
+        void* node;
+    };
+
+    /// Contained data: in place or reference to heap allocated data.
+    union Storage
+    {
+        Ref ref;
+        Buffer buffer;
+    };
 
-    /// @interface HandlerBase Wrapper for data storage.
-    struct HandlerBase // hint: use small object allocator
+    /// Table of operations on contained data, one static instance per type
+    /// and storage mode; functions receiving two data addresses require the
+    /// data to be of the same type, which is checked before the call.
+    struct Ops
     {
-        virtual const std::type_info& GetType() const = 0;
-        virtual HandlerBase* Clone() const = 0;
-        virtual ~HandlerBase() {}
-        virtual size_t GetAlignment() const  = 0;
+        const std::type_info* type;
+        AnyTypeId ( *id )();
+        size_t size;
+        size_t alignment;
+        bool inplace;
+        bool shared;
+        /// Data is trivially copyable.
+        bool trivial;
+        /// Type tag, see Any::Tag.
+        unsigned char tag;
+        /// Copy data into uninitialized storage.
+        void ( *clone )( const Storage&, Storage& );
+        /// Move data into uninitialized storage, source is left uninitialized.
+        void ( *move )( Storage&, Storage& );
+        /// Destroy data and release memory if allocated on the heap.
+        void ( *destroy )( Storage& );
+        void ( *assign )( Storage&, const void* );
+        /// Make data not shared with other instances.
+        void ( *detach )( Storage& );
+        /// Move data to shared block and return table for shared mode.
+        const Ops* ( *share )( Storage& );
+        bool ( *less )( const void*, const void* );
+        /// Three-way comparison: negative, zero or positive.
+        int ( *compare )( const void*, const void* );
+        bool ( *equal )( const void*, const void* );
+        size_t ( *hash )( const void* );
 #ifdef ANY_OSTREAM
-        virtual std::ostream& Serialize( std::ostream& ) const = 0;
-#endif        
+        std::ostream& ( *serialize )( std::ostream&, const void* );
+#endif
 #ifdef ANY_ISTREAM
-        virtual std::istream& DeSerialize( std::istream& ) const = 0;
-#endif        
-        virtual size_t SizeofData() const = 0;
-        virtual void* GetDataAddress() = 0;
-        virtual const void* GetDataAddress() const  = 0;
-        virtual void Assign( const HandlerBase& ) = 0;
-        virtual bool LessThan( const void* ) const  = 0; // type checked before call
-        virtual bool EqualTo( const void* ) const = 0;   // type checked before call
+        std::istream& ( *deserialize )( std::istream&, void* );
+#endif
     };
 
+    /// Tell if data of type @c T can be stored in place: data must be
+    /// nothrow-move-constructible to allow for non-throwing Swap.
+    template < class T > struct FitsInline
+    {
+        enum { Value = sizeof( T ) <= sizeof( Buffer )
+                       && std::alignment_of< T >::value
+                          <= std::alignment_of< Buffer >::value
+                       && std::is_nothrow_move_constructible< T >::value };
+    };
 
-    /// Struct for computing alignment of data.
-    template < typename T > struct Align
+    /// Tags of the types compared and assigned without indirect calls;
+    /// trivially copyable types are tagged only if stored in place.
+    enum Tag
     {
-        struct D
-        {
-            T d;
-            char c[ 1 ];
-        };
-        enum {Value = sizeof( D ) - sizeof( T )};
+        TAG_OTHER = 0,
+        TAG_BOOL,
+        TAG_INT,
+        TAG_LONG,
+        TAG_DOUBLE,
+        TAG_STRING
+    };
+    /// Compute tag of type @c T.
+    template < class T > struct TagOf
+    {
+        enum { Type = std::is_same< T, bool >::value ? TAG_BOOL
+                    : std::is_same< T, int >::value ? TAG_INT
+                    : std::is_same< T, long >::value ? TAG_LONG
+                    : std::is_same< T, double >::value ? TAG_DOUBLE
+                    : std::is_same< T, std::string >::value ? TAG_STRING
+                    : TAG_OTHER,
+               Value = Type == TAG_STRING || FitsInline< T >::Value
+                       ? Type : TAG_OTHER };
     };
+    /// Return @c true if table is the one of an in place trivially copyable
+    /// tagged type.
+    static bool IsTrivialTag( const Ops* o )
+    {
+        return o != 0 && o->tag >= TAG_BOOL && o->tag <= TAG_DOUBLE;
+    }
 
-    /// HandlerBase actual data container class.
-    template < class T > struct ValHandler :  HandlerBase
+    /// Heap allocated data, records the allocator used to create it.
+    template < class T > struct HeapNode
     {
-        typedef T Type;
-        T val_;
-        size_t alignment_;
-        ValHandler( const T& v ) : val_( v ), alignment_( Align< T >::Value )
+        T val;
+        IAnyAllocator* allocator;
+        template < class... ArgsT >
+        explicit HeapNode( IAnyAllocator& a, ArgsT&&... args )
+            : val( std::forward< ArgsT >( args )... ), allocator( &a )
         {}
-        const std::type_info& GetType() const { return typeid( T ); }
-        ValHandler* Clone() const { return new ValHandler( val_ ); }
+    };
+
+    /// Reference counted heap allocated data, destroyed through the
+    /// allocator used to create it.
+    template < class T > struct SharedNode : Referenced
+    {
+        T val;
+        IAnyAllocator* allocator;
+        template < class... ArgsT >
+        explicit SharedNode( IAnyAllocator& a, ArgsT&&... args )
+            : val( std::forward< ArgsT >( args )... ), allocator( &a )
+        {}
+        void Destroy() const { DeleteNode( const_cast< SharedNode* >( this ) ); }
+    };
+
+    /// Allocate and construct node through allocator.
+    template < class NodeT, class... ArgsT >
+    static NodeT* NewNode( IAnyAllocator& a, ArgsT&&... args )
+    {
+        void* p = a.Allocate( sizeof( NodeT ), std::alignment_of< NodeT >::value );
+        try {
+            return new ( p ) NodeT( a, std::forward< ArgsT >( args )... );
+        } catch( ... ) {
+            a.Deallocate( p, sizeof( NodeT ), std::alignment_of< NodeT >::value );
+            throw;
+        }
+    }
+    /// Destroy node and return memory to allocator.
+    template < class NodeT >
+    static void DeleteNode( NodeT* n )
+    {
+        IAnyAllocator* a = n->allocator;
+        n->~NodeT();
+        a->Deallocate( n, sizeof( NodeT ), std::alignment_of< NodeT >::value );
+    }
+    /// Make storage refer to node.
+    template < class NodeT >
+    static void SetRef( Storage& s, NodeT* n )
+    {
+        s.ref.data = &n->val;
+        s.ref.node = n;
+    }
+
+    template < class T > struct SharedHandler;
+
+    /// Implementation of operations on data of type @c T, stored in place
+    /// or in a heap node.
+    template < class T > struct Handler
+    {
+        typedef std::integral_constant< bool, FitsInline< T >::Value > Inplace;
+        typedef HeapNode< T > Node;
+        static T* Data( const Storage& s )
+        {
+            return Data( s, Inplace() );
+        }
+        static T* Data( const Storage& s, std::true_type )
+        {
+            return reinterpret_cast< T* >( const_cast< Buffer* >( &s.buffer ) );
+        }
+        static T* Data( const Storage& s, std::false_type )
+        {
+            return static_cast< T* >( s.ref.data );
+        }
+        /// Construct instance of @c T from @c args; heap memory is requested
+        /// to @c a or, if @c NULL, to the current thread's allocator.
+        template < class... ArgsT >
+        static void Create( Storage& s, IAnyAllocator* a, ArgsT&&... args )
+        {
+            Create( Inplace(), s, a, std::forward< ArgsT >( args )... );
+        }
+        template < class... ArgsT >
+        static void Create( std::true_type, Storage& s, IAnyAllocator*,
+                            ArgsT&&... args )
+        {
+            new ( &s.buffer ) T( std::forward< ArgsT >( args )... );
+        }
+        template < class... ArgsT >
+        static void Create( std::false_type, Storage& s, IAnyAllocator* a,
+                            ArgsT&&... args )
+        {
+            SetRef( s, NewNode< Node >( a ? *a : AnyCurrentAllocator(),
+                                        std::forward< ArgsT >( args )... ) );
+        }
+        /// Return allocator used for data, @c NULL if in place.
+        static IAnyAllocator* Allocator( const Storage& s )
+        {
+            return Inplace::value ? 0 : static_cast< Node* >( s.ref.node )->allocator;
+        }
+        static void Clone( const Storage& src, Storage& dst )
+        {
+            Create( dst, Allocator( src ), *Data( src ) );
+        }
+        /// Does not throw: data is stored in place only if nothrow move
+        /// constructible.
+        static void Move( Storage& src, Storage& dst ) noexcept
+        {
+            Move( src, dst, Inplace() );
+        }
+        static void Move( Storage& src, Storage& dst, std::true_type ) noexcept
+        {
+            T* p = Data( src );
+            new ( &dst.buffer ) T( std::move( *p ) );
+            p->~T();
+        }
+        static void Move( Storage& src, Storage& dst, std::false_type ) noexcept
+        {
+            dst.ref = src.ref;
+        }
+        static void Destroy( Storage& s ) noexcept
+        {
+            Destroy( s, Inplace() );
+        }
+        static void Destroy( Storage& s, std::true_type ) noexcept
+        {
+            Data( s )->~T();
+        }
+        static void Destroy( Storage& s, std::false_type ) noexcept
+        {
+            DeleteNode( static_cast< Node* >( s.ref.node ) );
+        }
+        static void Assign( Storage& dst, const void* src )
+        {
+            *Data( dst ) = *static_cast< const T* >( src );
+        }
+        static void Detach( Storage& ) {}
+        static const Ops* Share( Storage& s )
+        {
+            IAnyAllocator* a = Allocator( s );
+            SharedNode< T >* n = NewNode< SharedNode< T > >(
+                a ? *a : AnyCurrentAllocator(), std::move( *Data( s ) ) );
+            intrusive_ptr_add_ref( n );
+            Destroy( s );
+            SetRef( s, n );
+            return &SharedHandler< T >::ops;
+        }
+        static bool LessThan( const void* p1, const void* p2 )
+        {
+            return AnyLess( *static_cast< const T* >( p1 ),
+                            *static_cast< const T* >( p2 ) ); //use Koenig lookup to find specialization
+        }
+        static int Compare( const void* p1, const void* p2 )
+        {
+            return AnyCompare( *static_cast< const T* >( p1 ),
+                               *static_cast< const T* >( p2 ) ); //use Koenig lookup to find specialization
+        }
+        static bool EqualTo( const void* p1, const void* p2 )
+        {
+            return AnyEqual( *static_cast< const T* >( p1 ),
+                             *static_cast< const T* >( p2 ) ); //use Koenig lookup to find specialization
+        }
+        static size_t Hash( const void* p )
+        {
+            return AnyHash( *static_cast< const T* >( p ) ); //use Koenig lookup to find specialization
+        }
 #ifdef ANY_OSTREAM
-        std::ostream& Serialize( std::ostream& os ) const
+        static std::ostream& Serialize( std::ostream& os, const void* p )
         {
-            os << val_;
+            os << *static_cast< const T* >( p );
             return os;
         }
 #endif
 #ifdef ANY_ISTREAM
-        std::istream& DeSerialize( std::ostream& is ) const
+        static std::istream& DeSerialize( std::istream& is, void* p )
         {
-            is >> val_;
+            is >> *static_cast< T* >( p );
             return is;
         }
 #endif
-        size_t SizeofData() const { return sizeof( Type ); }
-        void* GetDataAddress() { return &val_; }
-        const void* GetDataAddress() const { return &val_; }
-        size_t GetAlignment() const { return alignment_; }
-        void Assign( const HandlerBase& rhs )
+        static constexpr Ops ops = {
+            &typeid( T ),
+            &AnyTypeIdOf< T >,
+            sizeof( T ),
+            std::alignment_of< T >::value,
+            FitsInline< T >::Value,
+            false,
+            std::is_trivially_copyable< T >::value,
+            TagOf< T >::Value,
+            &Clone,
+            &Move,
+            &Destroy,
+            &Assign,
+            &Detach,
+            &Share,
+            &LessThan,
+            &Compare,
+            &EqualTo,
+            &Hash
+#ifdef ANY_OSTREAM
+            , &Serialize
+#endif
+#ifdef ANY_ISTREAM
+            , &DeSerialize
+#endif
+        };
+    };
+
+    /// Implementation of operations on data of type @c T shared among
+    /// instances: copies increment the reference count, the data is copied
+    /// when detached from other instances.
+    template < class T > struct SharedHandler : Handler< T >
+    {
+        typedef SharedNode< T > Node;
+        static Node* GetNode( const Storage& s )
+        {
+            return static_cast< Node* >( s.ref.node );
+        }
+        static void Clone( const Storage& src, Storage& dst )
+        {
+            intrusive_ptr_add_ref( GetNode( src ) );
+            dst.ref = src.ref;
+        }
+        static void Move( Storage& src, Storage& dst ) noexcept
+        {
+            dst.ref = src.ref;
+        }
+        static void Destroy( Storage& s ) noexcept
         {
-            val_ = *( reinterpret_cast< const T* >( rhs.GetDataAddress() ) );
+            intrusive_ptr_release( GetNode( s ) );
         }
-        virtual bool LessThan( const void* pv ) const { // type checked before call
-            return AnyLess( val_, *reinterpret_cast< const T* >( pv ) ); //use Koenig lookup to find specialization
+        static void Detach( Storage& s )
+        {
+            Node* n = GetNode( s );
+            if( get_count( n ) == 1 ) return;
+            Node* c = NewNode< Node >( *n->allocator, n->val );
+            intrusive_ptr_add_ref( c );
+            SetRef( s, c );
+            intrusive_ptr_release( n );
         }
-        virtual bool EqualTo( const void* pv ) const { // type checked before call
-            return AnyEqual( val_, *reinterpret_cast< const T* >( pv ) ); //use Koenig lookup to find specialization
+        static void Assign( Storage& dst, const void* src )
+        {
+            Detach( dst );
+            *static_cast< T* >( dst.ref.data ) = *static_cast< const T* >( src );
         }
+        static const Ops* Share( Storage& ) { return &ops; }
+        static constexpr Ops ops = {
+            &typeid( T ),
+            &AnyTypeIdOf< T >,
+            sizeof( T ),
+            std::alignment_of< T >::value,
+            false,
+            true,
+            std::is_trivially_copyable< T >::value,
+            TAG_OTHER,
+            &Clone,
+            &Move,
+            &Destroy,
+            &Assign,
+            &Detach,
+            &Share,
+            &Handler< T >::LessThan,
+            &Handler< T >::Compare,
+            &Handler< T >::EqualTo,
+            &Handler< T >::Hash
+#ifdef ANY_OSTREAM
+            , &Handler< T >::Serialize
+#endif
+#ifdef ANY_ISTREAM
+            , &Handler< T >::DeSerialize
+#endif
+        };
     };
 
-    ///Pointer to contained data: deleted when Any instance deleted.
-    HandlerBase* pval_;
+    /// Return @c true if contained data is of type @c T. Addresses of
+    /// type_info objects are compared first, then type identifiers and
+    /// type_info objects, because modules loaded separately may have their
+    /// own copy of the same type_info: type_info comparison alone can fall
+    /// back to comparing type names.
+    template < class T > bool IsType() const noexcept
+    {
+        return ops_ != 0
+               && ( ops_->type == &typeid( T )
+                    || ( ops_->id() == AnyTypeIdOf< T >()
+                         && *ops_->type == typeid( T ) ) );
+    }
+    /// Return @c true if the tables refer to the same type, @c NULL tables
+    /// are considered of type EMPTY_.
+    static bool SameType( const Ops* o1, const Ops* o2 ) noexcept
+    {
+        if( o1 == o2 ) return true;
+        return o1 != 0 && o2 != 0
+               && ( o1->type == o2->type
+                    || ( o1->id() == o2->id() && *o1->type == *o2->type ) );
+    }
+
+    /// Three-way comparison of values of the same tagged type through the
+    /// @c AnyCompare overloads, without indirect calls.
+    /// @return @c false if values are not of the same tagged type
+    static bool TaggedCompare( const Any& a1, const Any& a2, int& r )
+    {
+        if( a1.ops_ != a2.ops_ || a1.ops_ == 0 ) return false;
+        switch( a1.ops_->tag ) {
+        case TAG_BOOL: r = AnyCompare( a1.Data< bool >(), a2.Data< bool >() ); break;
+        case TAG_INT: r = AnyCompare( a1.Data< int >(), a2.Data< int >() ); break;
+        case TAG_LONG: r = AnyCompare( a1.Data< long >(), a2.Data< long >() ); break;
+        case TAG_DOUBLE: r = AnyCompare( a1.Data< double >(), a2.Data< double >() ); break;
+        case TAG_STRING: r = AnyCompare( a1.Data< std::string >(), a2.Data< std::string >() ); break;
+        default: return false;
+        }
+        return true;
+    }
+    /// Equality of values of the same tagged type through the @c AnyEqual
+    /// overloads, without indirect calls.
+    /// @return @c false if values are not of the same tagged type
+    static bool TaggedEqual( const Any& a1, const Any& a2, bool& r )
+    {
+        if( a1.ops_ != a2.ops_ || a1.ops_ == 0 ) return false;
+        switch( a1.ops_->tag ) {
+        case TAG_BOOL: r = AnyEqual( a1.Data< bool >(), a2.Data< bool >() ); break;
+        case TAG_INT: r = AnyEqual( a1.Data< int >(), a2.Data< int >() ); break;
+        case TAG_LONG: r = AnyEqual( a1.Data< long >(), a2.Data< long >() ); break;
+        case TAG_DOUBLE: r = AnyEqual( a1.Data< double >(), a2.Data< double >() ); break;
+        case TAG_STRING: r = AnyEqual( a1.Data< std::string >(), a2.Data< std::string >() ); break;
+        default: return false;
+        }
+        return true;
+    }
+
+    /// Construct instance of @c T from @c args; @c this must be empty.
+    template < class T, class... ArgsT >
+    void Create( IAnyAllocator* a, ArgsT&&... args )
+    {
+        Handler< T >::Create( storage_, a, std::forward< ArgsT >( args )... );
+        ops_ = &Handler< T >::ops;
+    }
+    /// Return reference to contained data, type checked before call.
+    template < class T > T& Data() const
+    {
+        if( FitsInline< T >::Value && ops_->inplace )
+            return *Handler< T >::Data( storage_, std::true_type() );
+        return *static_cast< T* >( storage_.ref.data );
+    }
+    /// Return reference to contained data for modification, detached from
+    /// other instances if shared; type checked before call.
+    template < class T > T& MutableData() const
+    {
+        Detach();
+        return Data< T >();
+    }
+    /// Return address of contained data; instance must not be empty.
+    void* Address() const
+    {
+        return ops_->inplace ? const_cast< Buffer* >( &storage_.buffer )
+                             : storage_.ref.data;
+    }
+    /// Make contained data not shared with other instances.
+    void Detach() const
+    {
+        if( ops_->shared ) ops_->detach( storage_ );
+    }
+
+    ///Operations on contained data, @c NULL if instance empty.
+    const Ops* ops_;
+    ///Contained data; mutable because non-const access through const
+    ///instances detaches shared data.
+    mutable Storage storage_;
 #ifdef ANY_OSTREAM
     ///Overloaded operator to serialize data to output streams.
     friend inline std::ostream& operator<<( std::ostream& os, const Any& any )
     {
         if( any.Empty() ) return os;
-        return any.pval_->Serialize( os );
+        return any.ops_->serialize( os, any.Address() );
     }
 #endif
 #ifdef ANY_ISTREAM
-    ///Overloaded operator to serialize data to output streams.
-    friend inline std::istream& operator>>( std::istream& is, const Any& any )
+    ///Overloaded operator to read data from input streams into the
+    ///contained value, which determines the type of the data read.
+    friend inline std::istream& operator>>( std::istream& is, Any& any )
     {
-        return any.pval_->DeSerialize( os );
+        if( any.Empty() ) throw std::logic_error( "Attempt to read into empty instance" );
+        any.Detach();
+        return any.ops_->deserialize( is, any.Address() );
     }
 #endif
 
 };
 
-class AnyMover {
-    mutable Any* anyRef_;
-    friend class Any;
-    AnyMover();
-public:
-    AnyMover( Any& anyRef ) : anyRef_( &anyRef ) {}
-};
+template < class T >
+constexpr Any::Ops Any::Handler< T >::ops;
+template < class T >
+constexpr Any::Ops Any::SharedHandler< T >::ops;
 
-inline Any::Any( const AnyMover& ma ) : pval_( 0 ) {
-    std::swap( pval_, ma.anyRef_->pval_ );
+/// Hash of contained value with all the bits mixed (MurmurHash3 64 bit
+/// finalizer), for tables indexed by a subset of the bits: @c AnyHash
+/// returns integer values unchanged.
+inline unsigned long long AnyMixedHash( const Any& any ) {
+    unsigned long long h = AnyHash( any );
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
 }
 
-//inline Any& Any::operator=( const AnyMover& ma ) {
-//  std::swap( pval_, ma.anyRef_->pval_ );
-//}
+namespace std {
+/// Hash function object for unordered containers keyed by @c Any values.
+template <> struct hash< Any > {
+    size_t operator()( const Any& any ) const { return AnyHash( any ); }
+};
+}
 
-inline AnyMover AnyMove( Any m ) { 
-    return AnyMover( m ); 
+/// Cast to rvalue reference to select Any's move constructor and assignment;
+/// kept for compatibility with code written before move semantics support,
+/// equivalent to @c std::move.
+inline Any&& AnyMove( Any& m ) { 
+    return std::move( m ); 
+} 
+/// Cast to rvalue reference, overload for temporaries.
+inline Any&& AnyMove( Any&& m ) { 
+    return std::move( m ); 
 } 
 
 
+#ifdef ANY_OSTREAM
 ///Utility function to print the content of an std::vector of Any objects.
 inline std::ostream& operator<<( std::ostream& os, const std::vector< Any >& av )
 {
     std::copy( av.begin(), av.end(), std::ostream_iterator< Any >( os, ", " ) );
     return os;
 }
+#endif
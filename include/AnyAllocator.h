@@ -0,0 +1,73 @@
+#pragma once
+//Author: Ugo Varetto
+
+/// @file AnyAllocator.h Allocator interface used by Any for heap allocated
+/// values.
+
+#include <cstddef>
+#include <new>
+#include <boost/align/aligned_alloc.hpp>
+
+//------------------------------------------------------------------------------
+/// @interface IAnyAllocator Memory source for values which do not fit
+/// into the internal buffer of an @c Any instance.
+/// Implementations must be thread safe if the same instance is used by
+/// more than one thread; the allocator must outlive all the values
+/// allocated through it.
+/// @ingroup utility
+struct IAnyAllocator {
+    virtual void* Allocate( std::size_t size, std::size_t alignment ) = 0;
+    virtual void Deallocate( void* p, std::size_t size, std::size_t alignment ) = 0;
+    virtual ~IAnyAllocator() {}
+};
+
+/// Allocator using the default new/delete operators, and aligned allocation
+/// for alignments which operator new does not guarantee before C++17.
+class DefaultAnyAllocator : public IAnyAllocator {
+public:
+    void* Allocate( std::size_t size, std::size_t alignment ) {
+        if( alignment <= alignof( std::max_align_t ) ) return ::operator new( size );
+        void* p = boost::alignment::aligned_alloc( alignment, size );
+        if( !p ) throw std::bad_alloc();
+        return p;
+    }
+    void Deallocate( void* p, std::size_t, std::size_t alignment ) {
+        if( alignment <= alignof( std::max_align_t ) ) ::operator delete( p );
+        else boost::alignment::aligned_free( p );
+    }
+};
+
+/// Return global default allocator.
+inline IAnyAllocator& AnyDefaultAllocator() {
+    static DefaultAnyAllocator allocator;
+    return allocator;
+}
+
+/// Return reference to the per-thread pointer to the allocator used when
+/// creating new values; @c NULL selects the default allocator.
+inline IAnyAllocator*& AnyCurrentAllocatorPtr() {
+    static thread_local IAnyAllocator* allocator = 0;
+    return allocator;
+}
+
+/// Return allocator used by the current thread to create new values.
+inline IAnyAllocator& AnyCurrentAllocator() {
+    IAnyAllocator* a = AnyCurrentAllocatorPtr();
+    return a ? *a : AnyDefaultAllocator();
+}
+
+/// Select the allocator used by the current thread to create new values
+/// for the lifetime of the object; copies of existing values keep using the
+/// allocator of the copied value.
+class AnyAllocatorScope {
+public:
+    explicit AnyAllocatorScope( IAnyAllocator& a )
+        : prev_( AnyCurrentAllocatorPtr() ) {
+        AnyCurrentAllocatorPtr() = &a;
+    }
+    ~AnyAllocatorScope() { AnyCurrentAllocatorPtr() = prev_; }
+private:
+    AnyAllocatorScope( const AnyAllocatorScope& );
+    AnyAllocatorScope& operator=( const AnyAllocatorScope& );
+    IAnyAllocator* prev_;
+};
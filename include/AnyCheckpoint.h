@@ -0,0 +1,156 @@
+#pragma once
+//Author: Ugo Varetto
+
+/// @file AnyCheckpoint.h Incremental checkpoints of MapAnyStorage.
+///
+/// A checkpoint is a base snapshot file (see AnySnapshot.h) followed by
+/// delta files <base>.<n> holding, in the same format, the keys changed
+/// between consecutive checkpoints; deltas are applied in increasing order.
+/// Files are written with AnySnapshotWriter, which flushes them to disk and
+/// renames them into place, so that an interrupted checkpoint or compaction
+/// leaves a consistent set of files.
+/// Requires POSIX directory access.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/thread.hpp>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "AnyStorage.h"
+#include "AnySnapshot.h"
+
+//------------------------------------------------------------------------------
+/// @brief Writes the changes recorded by MapAnyStorage::TakeChanges as delta
+/// files, so that the cost of a checkpoint depends on the number of keys
+/// changed and not on the size of the storage; Compact() folds the deltas
+/// into the base snapshot.
+/// To not block writers while writing a delta, take the changes under the
+/// lock protecting the storage and pass them to Write().
+class AnyCheckpointer {
+public:
+    /// Use @c base as path of base snapshot and prefix of delta files.
+    explicit AnyCheckpointer( const std::string& base ) : base_( base ), next_( 1 ) {
+        const std::vector< unsigned > d = Deltas();
+        if( !d.empty() ) next_ = d.back() + 1;
+    }
+    /// Write changes of @c storage since previous checkpoint; change tracking
+    /// must have been enabled by Restore() or Compact( storage ).
+    void Checkpoint( MapAnyStorage& storage ) {
+        Write( storage.TakeChanges() );
+    }
+    /// Write delta file with sorted keys and values; changes taken before a
+    /// call to Compact( storage ) must be written before it.
+    void Write( const MapAnyStorage::Changes& changes ) {
+        boost::lock_guard< boost::mutex > lock( mutex_ );
+        WriteDelta( changes );
+    }
+    /// Load base snapshot and apply deltas; values in the base snapshot are
+    /// decoded on first access. Change tracking is enabled in the returned
+    /// storage.
+    MapAnyStorage* Restore() const {
+        boost::lock_guard< boost::mutex > lock( mutex_ );
+        return Load( Deltas() );
+    }
+    /// Write the changes recorded by @c storage as a delta, replace base
+    /// snapshot with the content of @c storage and remove deltas, then
+    /// enable change tracking in @c storage.
+    /// If deltas exist, @c storage must track changes since the last
+    /// checkpoint, otherwise @c std::logic_error is thrown: the deltas left
+    /// by an interrupted compaction are applied to the new base snapshot
+    /// on restore, and the newest of them must match @c storage.
+    void Compact( MapAnyStorage& storage ) {
+        boost::lock_guard< boost::mutex > lock( mutex_ );
+        if( !storage.TrackingChanges() && !Deltas().empty() )
+            throw std::logic_error( "AnyCheckpointer: storage does not track changes since last checkpoint" );
+        WriteDelta( storage.TakeChanges() );
+        Replace( storage, Deltas() );
+        storage.TrackChanges();
+    }
+    /// Fold deltas into base snapshot.
+    void Compact() {
+        boost::lock_guard< boost::mutex > lock( mutex_ );
+        const std::vector< unsigned > d = Deltas();
+        if( d.empty() ) return;
+        boost::intrusive_ptr< MapAnyStorage > m = Load( d );
+        Replace( *m, d );
+    }
+    /// Number of delta files.
+    std::size_t DeltaCount() const {
+        boost::lock_guard< boost::mutex > lock( mutex_ );
+        return Deltas().size();
+    }
+private:
+    /// Write delta file numbered @c next_ unless @c changes is empty;
+    /// requires lock.
+    void WriteDelta( const MapAnyStorage::Changes& changes ) {
+        if( changes.empty() ) return;
+        AnySnapshotWriter w( DeltaPath( next_ ), ANY_SNAPSHOT_MAP, changes.size() );
+        std::vector< char > kb;
+        for( MapAnyStorage::Changes::const_iterator i = changes.begin(); i != changes.end(); ++i ) {
+            kb.clear();
+            AnyEncode( i->first, kb );
+            w.Add( kb.data(), kb.size(), i->second );
+        }
+        w.Close();
+        ++next_;
+    }
+    std::string DeltaPath( unsigned n ) const {
+        char suffix[ 16 ];
+        std::snprintf( suffix, sizeof( suffix ), ".%u", n );
+        return base_ + suffix;
+    }
+    bool Exists( const std::string& path ) const {
+        return ::access( path.c_str(), F_OK ) == 0;
+    }
+    /// Sorted numbers of existing delta files.
+    std::vector< unsigned > Deltas() const {
+        const std::string::size_type slash = base_.rfind( '/' );
+        const std::string dir = slash == std::string::npos ? "." : base_.substr( 0, slash + 1 );
+        const std::string prefix = ( slash == std::string::npos ? base_ : base_.substr( slash + 1 ) ) + ".";
+        std::vector< unsigned > d;
+        DIR* dp = ::opendir( dir.c_str() );
+        if( !dp ) throw std::runtime_error( "Cannot read checkpoint directory: " + dir );
+        while( const dirent* e = ::readdir( dp ) ) {
+            const std::string name = e->d_name;
+            if( name.compare( 0, prefix.size(), prefix ) != 0 || name.size() == prefix.size()
+                || name.find_first_not_of( "0123456789", prefix.size() ) != std::string::npos ) continue;
+            d.push_back( unsigned( std::strtoul( name.c_str() + prefix.size(), 0, 10 ) ) );
+        }
+        ::closedir( dp );
+        std::sort( d.begin(), d.end() );
+        return d;
+    }
+    MapAnyStorage* Load( const std::vector< unsigned >& deltas ) const {
+        MapAnyStorage* m = Exists( base_ ) ? MapAnyStorage::Open( base_ ) : new MapAnyStorage;
+        try {
+            for( std::size_t d = 0; d != deltas.size(); ++d ) {
+                const boost::intrusive_ptr< AnySnapshotFile > f =
+                    new AnySnapshotFile( DeltaPath( deltas[ d ] ), ANY_SNAPSHOT_MAP );
+                for( std::size_t i = 0; i != f->Count(); ++i )
+                    m->Put( f->Value( i ), f->Key( i ).ToAny() );
+            }
+        } catch( ... ) {
+            delete m;
+            throw;
+        }
+        m->TrackChanges();
+        return m;
+    }
+    /// Write new base snapshot, then remove deltas in increasing order: if
+    /// interrupted the remaining deltas are newer than the ones removed and
+    /// are already included in the base snapshot.
+    void Replace( const MapAnyStorage& storage, const std::vector< unsigned >& deltas ) {
+        storage.Snapshot( base_ );
+        for( std::size_t d = 0; d != deltas.size(); ++d ) std::remove( DeltaPath( deltas[ d ] ).c_str() );
+    }
+private:
+    std::string base_;
+    unsigned next_;
+    mutable boost::mutex mutex_;
+};
@@ -0,0 +1,324 @@
+#pragma once
+//Author: Ugo Varetto
+
+/// @file AnyCodec.h Binary serialization of Any values.
+///
+/// Encoding of a value: 32 bit type code followed by the payload
+///  - empty instance: code 0, no payload
+///  - trivially copyable types: the bytes of the value
+///  - strings: 32 bit length followed by the characters
+///  - std::vector< Any >: 32 bit element count, table of 32 bit element
+///    offsets relative to the end of the table, elements encoded through
+///    the global registry
+/// Integers are written in native byte order: encoded data can be exchanged
+/// among processes running on the same architecture.
+/// Vectors nested more than @c AnyCodecRegistry::MAX_DEPTH levels deep are
+/// rejected when decoding.
+
+#include <cstring>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#include "Any.h"
+
+/// Type code of encoded values.
+typedef unsigned int AnyCode;
+
+/// Codes of the built-in types; codes below ANY_CODE_USER are reserved.
+enum AnyBuiltinCode {
+    ANY_CODE_EMPTY = 0,
+    ANY_CODE_BOOL,
+    ANY_CODE_CHAR,
+    ANY_CODE_SIGNED_CHAR,
+    ANY_CODE_UNSIGNED_CHAR,
+    ANY_CODE_SHORT,
+    ANY_CODE_UNSIGNED_SHORT,
+    ANY_CODE_INT,
+    ANY_CODE_UNSIGNED_INT,
+    ANY_CODE_LONG,
+    ANY_CODE_UNSIGNED_LONG,
+    ANY_CODE_LONG_LONG,
+    ANY_CODE_UNSIGNED_LONG_LONG,
+    ANY_CODE_FLOAT,
+    ANY_CODE_DOUBLE,
+    ANY_CODE_STRING,
+    ANY_CODE_VECTOR,
+    ANY_CODE_USER = 256
+};
+
+/// Append @c size bytes to buffer.
+inline void AnyCodecWrite( std::vector< char >& out, const void* p, std::size_t size )
+{
+    const char* b = static_cast< const char* >( p );
+    out.insert( out.end(), b, b + size );
+}
+
+/// Append 32 bit unsigned integer to buffer, throws @c std::length_error if
+/// @c n does not fit in 32 bits.
+inline void AnyCodecWriteSize( std::vector< char >& out, std::size_t n )
+{
+    if( n > std::numeric_limits< unsigned int >::max() )
+        throw std::length_error( "Any encoding: size does not fit in 32 bits" );
+    const unsigned int u = static_cast< unsigned int >( n );
+    AnyCodecWrite( out, &u, sizeof( u ) );
+}
+
+/// Copy @c size bytes from buffer and advance @c p, throws
+/// @c std::runtime_error if fewer than @c size bytes are available.
+inline void AnyCodecRead( const char*& p, const char* end, void* dst, std::size_t size )
+{
+    if( std::size_t( end - p ) < size )
+        throw std::runtime_error( "Any decoding: truncated buffer" );
+    std::memcpy( dst, p, size );
+    p += size;
+}
+
+/// Read 32 bit unsigned integer from buffer.
+inline std::size_t AnyCodecReadSize( const char*& p, const char* end )
+{
+    unsigned int u;
+    AnyCodecRead( p, end, &u, sizeof( u ) );
+    return u;
+}
+
+/// Encoding and decoding functions of one type.
+struct AnyCodecEntry {
+    AnyCode code;
+    AnyTypeId id;
+    const std::type_info* type;
+    /// Size of payload if fixed, zero if variable.
+    std::size_t size;
+    /// Append payload of value at address to buffer.
+    void ( *encode )( const void*, std::vector< char >& );
+    /// Read payload, advance pointer and store decoded value into empty
+    /// Any instance.
+    void ( *decode )( const char*&, const char*, Any& );
+};
+
+//------------------------------------------------------------------------------
+/// @brief Map between types and codes used to encode them. The global
+/// instance returned by AnyCodecs() has the built-in types already
+/// registered; registrations must be completed before the registry is used
+/// concurrently by more than one thread.
+/// @ingroup utility
+class AnyCodecRegistry {
+public:
+    /// Maximum nesting level of decoded vectors.
+    enum { MAX_DEPTH = 64 };
+    typedef void ( *EncodeFun )( const void*, std::vector< char >& );
+    typedef void ( *DecodeFun )( const char*&, const char*, Any& );
+    /// Register built-in types.
+    AnyCodecRegistry();
+    /// Register trivially copyable type, encoded as a copy of its bytes.
+    template < class T >
+    void Register( AnyCode code )
+    {
+        static_assert( std::is_trivially_copyable< T >::value,
+                       "Type must be trivially copyable or provide encoding functions" );
+        Add( code, AnyTypeIdOf< T >(), typeid( T ), sizeof( T ),
+             &EncodePod< T >, &DecodePod< T > );
+    }
+    /// Register type with custom encoding functions, throws
+    /// @c std::logic_error if code or type already registered or if the
+    /// identifier of the type is the one of another registered type.
+    template < class T >
+    void Register( AnyCode code, EncodeFun encode, DecodeFun decode )
+    {
+        Add( code, AnyTypeIdOf< T >(), typeid( T ), 0, encode, decode );
+    }
+    /// Return entry of type @c type with identifier @c id, @c NULL if not
+    /// registered; the type is checked as well since identifiers are hashes
+    /// of type names.
+    const AnyCodecEntry* FindType( AnyTypeId id, const std::type_info& type ) const
+    {
+        std::unordered_map< AnyTypeId, AnyCodecEntry >::const_iterator i = byId_.find( id );
+        return i != byId_.end() && *i->second.type == type ? &i->second : 0;
+    }
+    /// Return entry of type with code @c code, @c NULL if not registered.
+    const AnyCodecEntry* FindCode( AnyCode code ) const
+    {
+        std::unordered_map< AnyCode, AnyCodecEntry >::const_iterator i = byCode_.find( code );
+        return i != byCode_.end() ? &i->second : 0;
+    }
+    /// Append encoded value to buffer, throws @c std::logic_error if
+    /// type not registered.
+    void Encode( const Any& a, std::vector< char >& out ) const
+    {
+        if( a.Empty() ) {
+            const AnyCode code = ANY_CODE_EMPTY;
+            AnyCodecWrite( out, &code, sizeof( code ) );
+            return;
+        }
+        const AnyCodecEntry* e = FindType( a.TypeId(), a.Type() );
+        if( !e ) throw std::logic_error( std::string( "No Any codec registered for " )
+                                         + a.Type().name() );
+        AnyCodecWrite( out, &e->code, sizeof( e->code ) );
+        e->encode( AnyAddress( a ), out );
+    }
+    /// Decode value and advance @c p past it, throws @c std::runtime_error
+    /// if data truncated or type code not registered.
+    Any Decode( const char*& p, const char* end ) const
+    {
+        AnyCode code;
+        AnyCodecRead( p, end, &code, sizeof( code ) );
+        Any a;
+        if( code == ANY_CODE_EMPTY ) return a;
+        const AnyCodecEntry* e = FindCode( code );
+        if( !e ) throw std::runtime_error( "Any decoding: unknown type code" );
+        e->decode( p, end, a );
+        return a;
+    }
+public:
+    /// Encoding functions of the built-in types, @c EncodeString and
+    /// @c DecodeString can be registered for other @c std::basic_string
+    /// instances.
+    template < class T >
+    static void EncodePod( const void* v, std::vector< char >& out )
+    {
+        AnyCodecWrite( out, v, sizeof( T ) );
+    }
+    template < class T >
+    static void DecodePod( const char*& p, const char* end, Any& a )
+    {
+        AnyCodecRead( p, end, &a.Emplace< T >(), sizeof( T ) );
+    }
+    template < class StringT >
+    static void EncodeString( const void* v, std::vector< char >& out )
+    {
+        const StringT& s = *static_cast< const StringT* >( v );
+        AnyCodecWriteSize( out, s.size() );
+        AnyCodecWrite( out, s.data(), s.size() * sizeof( typename StringT::value_type ) );
+    }
+    template < class StringT >
+    static void DecodeString( const char*& p, const char* end, Any& a )
+    {
+        typedef typename StringT::value_type C;
+        const std::size_t n = AnyCodecReadSize( p, end );
+        if( std::size_t( end - p ) / sizeof( C ) < n )
+            throw std::runtime_error( "Any decoding: truncated buffer" );
+        StringT& s = a.Emplace< StringT >( n, C() );
+        if( n ) std::memcpy( &s[ 0 ], p, n * sizeof( C ) );
+        p += n * sizeof( C );
+    }
+    static void EncodeVector( const void* v, std::vector< char >& out );
+    static void DecodeVector( const char*& p, const char* end, Any& a );
+private:
+    void Add( AnyCode code, AnyTypeId id, const std::type_info& type,
+              std::size_t size, EncodeFun encode, DecodeFun decode )
+    {
+        const AnyCodecEntry e = { code, id, &type, size, encode, decode };
+        std::unordered_map< AnyTypeId, AnyCodecEntry >::const_iterator i = byId_.find( id );
+        if( i != byId_.end() && *i->second.type != type )
+            throw std::logic_error( std::string( "Any codec: same type identifier for " )
+                                    + type.name() + " and " + i->second.type->name() );
+        if( i != byId_.end() || byCode_.count( code ) )
+            throw std::logic_error( std::string( "Any codec already registered for " )
+                                    + type.name() );
+        byId_[ id ] = e;
+        byCode_[ code ] = e;
+    }
+private:
+    std::unordered_map< AnyTypeId, AnyCodecEntry > byId_;
+    std::unordered_map< AnyCode, AnyCodecEntry > byCode_;
+};
+
+/// Return global registry.
+inline AnyCodecRegistry& AnyCodecs()
+{
+    static AnyCodecRegistry registry;
+    return registry;
+}
+
+inline AnyCodecRegistry::AnyCodecRegistry()
+{
+    Register< bool >( ANY_CODE_BOOL );
+    Register< char >( ANY_CODE_CHAR );
+    Register< signed char >( ANY_CODE_SIGNED_CHAR );
+    Register< unsigned char >( ANY_CODE_UNSIGNED_CHAR );
+    Register< short >( ANY_CODE_SHORT );
+    Register< unsigned short >( ANY_CODE_UNSIGNED_SHORT );
+    Register< int >( ANY_CODE_INT );
+    Register< unsigned int >( ANY_CODE_UNSIGNED_INT );
+    Register< long >( ANY_CODE_LONG );
+    Register< unsigned long >( ANY_CODE_UNSIGNED_LONG );
+    Register< long long >( ANY_CODE_LONG_LONG );
+    Register< unsigned long long >( ANY_CODE_UNSIGNED_LONG_LONG );
+    Register< float >( ANY_CODE_FLOAT );
+    Register< double >( ANY_CODE_DOUBLE );
+    Register< std::string >( ANY_CODE_STRING, &EncodeString< std::string >,
+                             &DecodeString< std::string > );
+    Register< std::vector< Any > >( ANY_CODE_VECTOR, &EncodeVector, &DecodeVector );
+}
+
+inline void AnyCodecRegistry::EncodeVector( const void* v, std::vector< char >& out )
+{
+    const std::vector< Any >& av = *static_cast< const std::vector< Any >* >( v );
+    AnyCodecWriteSize( out, av.size() );
+    const std::size_t table = out.size();
+    out.resize( table + av.size() * sizeof( unsigned int ) );
+    const std::size_t begin = out.size();
+    for( std::size_t i = 0; i != av.size(); ++i ) {
+        if( out.size() - begin > std::numeric_limits< unsigned int >::max() )
+            throw std::length_error( "Any encoding: size does not fit in 32 bits" );
+        const unsigned int offset = static_cast< unsigned int >( out.size() - begin );
+        std::memcpy( &out[ table + i * sizeof( offset ) ], &offset, sizeof( offset ) );
+        AnyCodecs().Encode( av[ i ], out );
+    }
+}
+
+inline void AnyCodecRegistry::DecodeVector( const char*& p, const char* end, Any& a )
+{
+    //nesting level of the vectors being decoded by this thread
+    static thread_local unsigned depth = 0;
+    if( depth == MAX_DEPTH ) throw std::runtime_error( "Any decoding: vectors nested too deep" );
+    const std::size_t n = AnyCodecReadSize( p, end );
+    if( std::size_t( end - p ) / sizeof( unsigned int ) < n )
+        throw std::runtime_error( "Any decoding: truncated buffer" );
+    p += n * sizeof( unsigned int );
+    std::vector< Any >& av = a.Emplace< std::vector< Any > >();
+    av.reserve( n );
+    ++depth;
+    try {
+        for( std::size_t i = 0; i != n; ++i ) av.push_back( AnyCodecs().Decode( p, end ) );
+    } catch( ... ) {
+        --depth;
+        throw;
+    }
+    --depth;
+}
+
+/// Append encoded value to buffer using the global registry.
+inline void AnyEncode( const Any& a, std::vector< char >& out )
+{
+    AnyCodecs().Encode( a, out );
+}
+
+/// Return encoded value.
+inline std::vector< char > AnyEncode( const Any& a )
+{
+    std::vector< char > out;
+    AnyEncode( a, out );
+    return out;
+}
+
+/// Decode value at @c p and advance @c p past it using the global registry.
+inline Any AnyDecode( const char*& p, const char* end )
+{
+    return AnyCodecs().Decode( p, end );
+}
+
+/// Decode value stored in buffer, throws @c std::runtime_error if bytes
+/// follow the encoded value.
+inline Any AnyDecode( const std::vector< char >& in )
+{
+    const char* p = in.empty() ? 0 : &in[ 0 ];
+    const char* end = p + in.size();
+    Any a = AnyDecode( p, end );
+    if( p != end ) throw std::runtime_error( "Any decoding: trailing bytes" );
+    return a;
+}
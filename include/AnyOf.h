@@ -0,0 +1,432 @@
+#pragma once
+//Author: Ugo Varetto
+
+/// @file AnyOf.h Implementation of class to hold instances of a closed set
+/// of types.
+
+#include <cstddef>
+#include <new>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+#include <cassert>
+
+#include "Any.h"
+#include "AnyVisit.h"
+
+/// Position of type @c T in list @c Ts, size of list if not found.
+template < class T, class... Ts > struct AnyOfIndex;
+
+template < class T > struct AnyOfIndex< T >
+    : std::integral_constant< std::size_t, 0 > {};
+
+template < class T, class U, class... Ts > struct AnyOfIndex< T, U, Ts... >
+    : std::integral_constant< std::size_t, std::is_same< T, U >::value
+                                  ? 0 : 1 + AnyOfIndex< T, Ts... >::value > {};
+
+//------------------------------------------------------------------------------
+/// @brief Class that can hold an instance of one of the types @c Ts, stored
+/// in place together with a one byte index of its type in @c Ts: no heap
+/// allocation is performed and operations are dispatched through per-type
+/// function tables. Offers the same access and comparison API as @c Any
+/// (@c AnyRef, @c AnyPtr, @c AnyVal, @c AnyCast, conversion operators,
+/// comparison operators, which require the @c AnyLess and @c AnyEqual
+/// overloads of the contained types) and converts to and from @c Any through
+/// ToAny() and the explicit constructors.
+/// @note conversion to @c Any is explicit: @c Any's forwarding constructor
+/// would otherwise store the AnyOf instance itself.
+/// @ingroup utility
+template < class... Ts >
+class AnyOf {
+    static_assert( sizeof...( Ts ) > 0 && sizeof...( Ts ) < 255, "Invalid number of types" );
+    /// Enable overload for types in @c Ts only.
+    template < class ValT, class R = void >
+    struct EnableIfInList : std::enable_if<
+        AnyOfIndex< typename std::decay< ValT >::type, Ts... >::value
+            < sizeof...( Ts ), R > {};
+public:
+    /// Index of empty instances.
+    enum { NPOS = sizeof...( Ts ) };
+    /// Default constructor: creates empty instance.
+    AnyOf() : index_( NPOS ) {}
+    /// Constructor accepting a value of one of the types in @c Ts, copied or
+    /// moved into internal storage.
+    template < class ValT, class = typename EnableIfInList< ValT >::type >
+    AnyOf( ValT&& v ) : index_( NPOS )
+    {
+        typedef typename std::decay< ValT >::type T;
+        new ( &storage_ ) T( std::forward< ValT >( v ) );
+        index_ = AnyOfIndex< T, Ts... >::value;
+    }
+    /// Copy constructor.
+    AnyOf( const AnyOf& a ) : index_( NPOS )
+    {
+        if( a.Empty() ) return;
+        Table::Copy( a.index_, &storage_, &a.storage_ );
+        index_ = a.index_;
+    }
+    /// Move constructor: @c a is left empty.
+    AnyOf( AnyOf&& a ) : index_( NPOS ) { MoveFrom( a ); }
+    /// Conversion from @c Any, throws @c std::logic_error if the contained
+    /// type is not in @c Ts.
+    explicit AnyOf( const Any& a ) : index_( NPOS )
+    {
+        if( a.Empty() ) return;
+        const unsigned char i = FindAnyType( a );
+        Table::CopyFromAny( i, &storage_, a );
+        index_ = i;
+    }
+    /// Conversion from @c Any moving the contained value, throws
+    /// @c std::logic_error if the contained type is not in @c Ts.
+    explicit AnyOf( Any&& a ) : index_( NPOS )
+    {
+        if( a.Empty() ) return;
+        const unsigned char i = FindAnyType( a );
+        Table::MoveFromAny( i, &storage_, a );
+        index_ = i;
+    }
+    /// Destructor.
+    ~AnyOf() { Release(); }
+    /// Assignment: values of the same type are assigned in place, instance
+    /// is left empty if the construction of a value of a different type
+    /// throws.
+    AnyOf& operator=( const AnyOf& a )
+    {
+        if( &a == this ) return *this;
+        if( index_ == a.index_ && !Empty() ) {
+            Table::Assign( index_, &storage_, &a.storage_ );
+            return *this;
+        }
+        Release();
+        if( a.Empty() ) return *this;
+        Table::Copy( a.index_, &storage_, &a.storage_ );
+        index_ = a.index_;
+        return *this;
+    }
+    /// Move assignment: @c a is left empty.
+    AnyOf& operator=( AnyOf&& a )
+    {
+        if( &a == this ) return *this;
+        Release();
+        MoveFrom( a );
+        return *this;
+    }
+    /// Assignment from value of one of the types in @c Ts.
+    template < class ValT >
+    typename EnableIfInList< ValT, AnyOf& >::type operator=( ValT&& v )
+    {
+        typedef typename std::decay< ValT >::type T;
+        if( Is< T >() ) {
+            *Ptr< T >() = std::forward< ValT >( v );
+            return *this;
+        }
+        Emplace< T >( std::forward< ValT >( v ) );
+        return *this;
+    }
+    /// Replace content with an instance of @c T constructed in place from
+    /// @c args; instance is left empty if construction throws.
+    template < class T, class... ArgsT >
+    T& Emplace( ArgsT&&... args )
+    {
+        static_assert( AnyOfIndex< T, Ts... >::value < NPOS, "Type not in list" );
+        Release();
+        T* p = new ( &storage_ ) T( std::forward< ArgsT >( args )... );
+        index_ = AnyOfIndex< T, Ts... >::value;
+        return *p;
+    }
+    /// Swap two instances.
+    AnyOf& Swap( AnyOf& a )
+    {
+        AnyOf tmp( std::move( a ) );
+        a = std::move( *this );
+        *this = std::move( tmp );
+        return *this;
+    }
+public:
+    /// Returns @c true if instance empty.
+    bool Empty() const { return index_ == NPOS; }
+    /// Returns position of contained type in @c Ts, @c NPOS if empty.
+    std::size_t Index() const { return index_; }
+    /// Returns type of contained data or Any::EMPTY_ if instance empty.
+    const std::type_info& Type() const
+    {
+        return !Empty() ? Table::Type( index_ ) : typeid( Any::EMPTY_ );
+    }
+    /// Returns @c true if contained data is of type @c ValT; always @c false
+    /// for empty instances, whose index equals the one of types not in @c Ts.
+    template < class ValT > bool Is() const noexcept
+    {
+        return !Empty() && index_ == AnyOfIndex< ValT, Ts... >::value;
+    }
+    /// Returns address of contained data, @c NULL if not of type @c ValT.
+    template < class ValT > ValT* Ptr() noexcept
+    {
+        return Is< ValT >() ? reinterpret_cast< ValT* >( &storage_ ) : 0;
+    }
+    /// Returns address of contained data, @c NULL if not of type @c ValT.
+    template < class ValT > const ValT* Ptr() const noexcept
+    {
+        return Is< ValT >() ? reinterpret_cast< const ValT* >( &storage_ ) : 0;
+    }
+    /// Check if contained data is of type @c ValT.
+    template < class ValT > void CheckType() const
+    {
+#if ANY_CHECK_TYPE
+        if( !Is< ValT >() )
+            throw std::logic_error(
+                    ( std::string( " Attempt to convert from ")
+                    + Type().name()
+                    + std::string( " to " )
+                    + typeid( ValT ).name() ).c_str() );
+#else
+        assert( Is< ValT >() );
+#endif
+    }
+    /// Copy contained value into an @c Any instance.
+    Any ToAny() const &
+    {
+        return !Empty() ? Table::ToAny( index_, &storage_ ) : Any();
+    }
+    /// Move contained value into an @c Any instance.
+    Any ToAny() &&
+    {
+        return !Empty() ? Table::MoveToAny( index_, &storage_ ) : Any();
+    }
+    /// Equality: check by converting value to contained value type then
+    /// invoking equality operator on converted type.
+    template < class ValT >
+    bool operator==( const ValT& v ) const
+    {
+        CheckType< ValT >();
+        return *Ptr< ValT >() == v;
+    }
+    ///Convert to const reference.
+    template < class ValT > operator const ValT&() const
+    {
+        CheckType< ValT >();
+        return *Ptr< ValT >();
+    }
+    ///Convert to reference.
+    template < class ValT > operator ValT&()
+    {
+        CheckType< ValT >();
+        return *Ptr< ValT >();
+    }
+    /// Less than operator
+    friend bool operator<( const AnyOf& a1, const AnyOf& a2 ) {
+        CheckSameType( a1, a2 );
+        return Table::Less( a1.index_, &a1.storage_, &a2.storage_ );
+    }
+    /// Greater than operator
+    friend bool operator>( const AnyOf& a1, const AnyOf& a2 ) {
+        CheckSameType( a1, a2 );
+        return Table::Less( a1.index_, &a2.storage_, &a1.storage_ );
+    }
+    /// Equality operator
+    friend bool operator==( const AnyOf& a1, const AnyOf& a2 ) {
+        CheckSameType( a1, a2 );
+        return Table::Equal( a1.index_, &a1.storage_, &a2.storage_ );
+    }
+    /// Inequality operator
+    friend bool operator!=( const AnyOf& a1, const AnyOf& a2 ) {
+        CheckSameType( a1, a2 );
+        return !Table::Equal( a1.index_, &a1.storage_, &a2.storage_ );
+    }
+    /// Three-way comparison, see AnyCompare( const Any&, const Any& ).
+    friend int AnyCompare( const AnyOf& a1, const AnyOf& a2 ) {
+        CheckSameType( a1, a2 );
+        return Table::Compare( a1.index_, &a1.storage_, &a2.storage_ );
+    }
+private:
+    typedef typename std::aligned_union< 1, Ts... >::type Storage;
+
+    /// Functions operating on contained data: each one selects the
+    /// implementation for the contained type from a table indexed by the
+    /// position of the type in @c Ts.
+    struct Table {
+        template < class T > static void CopyT( void* d, const void* s ) {
+            new ( d ) T( *static_cast< const T* >( s ) );
+        }
+        template < class T > static void MoveT( void* d, void* s ) {
+            new ( d ) T( std::move( *static_cast< T* >( s ) ) );
+        }
+        template < class T > static void AssignT( void* d, const void* s ) {
+            *static_cast< T* >( d ) = *static_cast< const T* >( s );
+        }
+        template < class T > static void DestroyT( void* p ) {
+            static_cast< T* >( p )->~T();
+        }
+        template < class T > static void CopyFromAnyT( void* d, const Any& a ) {
+            new ( d ) T( AnyRef< T >( a ) );
+        }
+        template < class T > static void MoveFromAnyT( void* d, Any& a ) {
+            new ( d ) T( std::move( AnyRef< T >( a ) ) );
+        }
+        template < class T > static Any ToAnyT( const void* p ) {
+            return Any( *static_cast< const T* >( p ) );
+        }
+        template < class T > static Any MoveToAnyT( void* p ) {
+            return Any( std::move( *static_cast< T* >( p ) ) );
+        }
+        template < class T > static bool LessT( const void* p1, const void* p2 ) {
+            return AnyLess( *static_cast< const T* >( p1 ),
+                            *static_cast< const T* >( p2 ) ); //use Koenig lookup to find specialization
+        }
+        template < class T > static bool EqualT( const void* p1, const void* p2 ) {
+            return AnyEqual( *static_cast< const T* >( p1 ),
+                             *static_cast< const T* >( p2 ) ); //use Koenig lookup to find specialization
+        }
+        template < class T > static int CompareT( const void* p1, const void* p2 ) {
+            return AnyCompare( *static_cast< const T* >( p1 ),
+                               *static_cast< const T* >( p2 ) ); //use Koenig lookup to find specialization
+        }
+        static void Copy( std::size_t i, void* d, const void* s ) {
+            static void ( * const f[] )( void*, const void* ) = { &CopyT< Ts >... };
+            f[ i ]( d, s );
+        }
+        static void Move( std::size_t i, void* d, void* s ) {
+            static void ( * const f[] )( void*, void* ) = { &MoveT< Ts >... };
+            f[ i ]( d, s );
+        }
+        static void Assign( std::size_t i, void* d, const void* s ) {
+            static void ( * const f[] )( void*, const void* ) = { &AssignT< Ts >... };
+            f[ i ]( d, s );
+        }
+        static void Destroy( std::size_t i, void* p ) {
+            static void ( * const f[] )( void* ) = { &DestroyT< Ts >... };
+            f[ i ]( p );
+        }
+        static void CopyFromAny( std::size_t i, void* d, const Any& a ) {
+            static void ( * const f[] )( void*, const Any& ) = { &CopyFromAnyT< Ts >... };
+            f[ i ]( d, a );
+        }
+        static void MoveFromAny( std::size_t i, void* d, Any& a ) {
+            static void ( * const f[] )( void*, Any& ) = { &MoveFromAnyT< Ts >... };
+            f[ i ]( d, a );
+        }
+        static Any ToAny( std::size_t i, const void* p ) {
+            static Any ( * const f[] )( const void* ) = { &ToAnyT< Ts >... };
+            return f[ i ]( p );
+        }
+        static Any MoveToAny( std::size_t i, void* p ) {
+            static Any ( * const f[] )( void* ) = { &MoveToAnyT< Ts >... };
+            return f[ i ]( p );
+        }
+        static bool Less( std::size_t i, const void* p1, const void* p2 ) {
+            static bool ( * const f[] )( const void*, const void* ) = { &LessT< Ts >... };
+            return f[ i ]( p1, p2 );
+        }
+        static bool Equal( std::size_t i, const void* p1, const void* p2 ) {
+            static bool ( * const f[] )( const void*, const void* ) = { &EqualT< Ts >... };
+            return f[ i ]( p1, p2 );
+        }
+        static int Compare( std::size_t i, const void* p1, const void* p2 ) {
+            static int ( * const f[] )( const void*, const void* ) = { &CompareT< Ts >... };
+            return f[ i ]( p1, p2 );
+        }
+        static const std::type_info& Type( std::size_t i ) {
+            static const std::type_info* const t[] = { &typeid( Ts )... };
+            return *t[ i ];
+        }
+    };
+
+    /// Return position in @c Ts of the type of the value contained in
+    /// non-empty @c Any instance, throw @c std::logic_error if not found.
+    static unsigned char FindAnyType( const Any& a )
+    {
+        const std::size_t i = AnyTypeIndex< Ts... >::Find( a.TypeId() );
+        if( i == NPOS )
+            throw std::logic_error(
+                    ( std::string( " Attempt to convert from ")
+                    + a.Type().name()
+                    + std::string( " to " )
+                    + typeid( AnyOf ).name() ).c_str() );
+        return static_cast< unsigned char >( i );
+    }
+    /// Check that instances are not empty and hold values of the same type.
+    static void CheckSameType( const AnyOf& a1, const AnyOf& a2 )
+    {
+#if ANY_CHECK_TYPE
+        if( a1.index_ != a2.index_ )
+            throw std::logic_error(
+                    ( std::string( " Attempt to convert between ")
+                    + a1.Type().name()
+                    + std::string( " and " )
+                    + a2.Type().name() ).c_str() );
+#else
+        assert( a1.index_ == a2.index_ );
+#endif
+        if( a1.Empty() ) throw std::logic_error( "Attempt to compare empty values" );
+    }
+    /// Destroy contained value.
+    void Release()
+    {
+        if( Empty() ) return;
+        Table::Destroy( index_, &storage_ );
+        index_ = NPOS;
+    }
+    /// Take ownership of the value contained in @c a, which is left empty;
+    /// @c this must be empty.
+    void MoveFrom( AnyOf& a )
+    {
+        if( a.Empty() ) return;
+        Table::Move( a.index_, &storage_, &a.storage_ );
+        index_ = a.index_;
+        a.Release();
+    }
+private:
+    Storage storage_;
+    unsigned char index_;
+};
+
+/// Give access to contained data.
+template < class AnyT, class... Ts >
+AnyT& AnyRef( AnyOf< Ts... >& any )
+{
+    any.template CheckType< AnyT >();
+    return *any.template Ptr< AnyT >();
+}
+/// Give access to contained const data.
+template < class AnyT, class... Ts >
+const AnyT& AnyRef( const AnyOf< Ts... >& any )
+{
+    any.template CheckType< AnyT >();
+    return *any.template Ptr< AnyT >();
+}
+/// Give access to address of contained data.
+template < class AnyT, class... Ts >
+AnyT* AnyPtr( AnyOf< Ts... >& any )
+{
+    any.template CheckType< AnyT >();
+    return any.template Ptr< AnyT >();
+}
+/// Give access to address of contained const data.
+template < class AnyT, class... Ts >
+const AnyT* AnyPtr( const AnyOf< Ts... >& any )
+{
+    any.template CheckType< AnyT >();
+    return any.template Ptr< AnyT >();
+}
+/// Return copy of contained data.
+template < class AnyT, class... Ts >
+AnyT AnyVal( const AnyOf< Ts... >& any )
+{
+    any.template CheckType< AnyT >();
+    return *any.template Ptr< AnyT >();
+}
+/// Give access to address of contained data, @c NULL if @c any is @c NULL,
+/// empty or not holding data of type @c AnyT.
+template < class AnyT, class... Ts >
+AnyT* AnyCast( AnyOf< Ts... >* any ) noexcept
+{
+    return any ? any->template Ptr< AnyT >() : 0;
+}
+/// Give access to address of contained const data, @c NULL if @c any is
+/// @c NULL, empty or not holding data of type @c AnyT.
+template < class AnyT, class... Ts >
+const AnyT* AnyCast( const AnyOf< Ts... >* any ) noexcept
+{
+    return any ? any->template Ptr< AnyT >() : 0;
+}
@@ -0,0 +1,89 @@
+#pragma once
+//Author: Ugo Varetto
+
+/// @file AnyRWMutex.h Reader biased shared mutex.
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+
+//------------------------------------------------------------------------------
+/// @brief Shared mutex optimized for frequent reads and rare writes: each
+/// thread counts its shared locks in one of @c SLOTS counters placed on
+/// separate cache lines, so that readers do not write to shared memory
+/// locations; a writer marks the mutex as locked, then waits until all
+/// counters are zero. Readers finding the mutex locked, and writers waiting
+/// for readers, yield instead of blocking: not suitable for long critical
+/// sections.
+/// Models the SharedLockable concept, use with @c boost::shared_lock and
+/// @c boost::unique_lock; not recursive.
+class AnyRWMutex : boost::noncopyable {
+public:
+    enum { SLOTS = 32, CACHE_LINE_SIZE = 64 };
+    AnyRWMutex() : writer_( false ) {
+        for( int i = 0; i != SLOTS; ++i ) readers_[ i ].count.store( 0, boost::memory_order_relaxed );
+    }
+    void lock_shared() {
+        boost::atomic< int >& c = readers_[ Slot() ].count;
+        for( ;; ) {
+            //sequentially consistent so that either the reader sees the
+            //writer flag or the writer sees the counter
+            c.fetch_add( 1, boost::memory_order_seq_cst );
+            if( !writer_.load( boost::memory_order_seq_cst ) ) return;
+            c.fetch_sub( 1, boost::memory_order_release );
+            while( writer_.load( boost::memory_order_relaxed ) ) boost::this_thread::yield();
+        }
+    }
+    bool try_lock_shared() {
+        boost::atomic< int >& c = readers_[ Slot() ].count;
+        c.fetch_add( 1, boost::memory_order_seq_cst );
+        if( !writer_.load( boost::memory_order_seq_cst ) ) return true;
+        c.fetch_sub( 1, boost::memory_order_release );
+        return false;
+    }
+    void unlock_shared() {
+        readers_[ Slot() ].count.fetch_sub( 1, boost::memory_order_release );
+    }
+    void lock() {
+        writers_.lock();
+        //sequentially consistent, paired with lock_shared: a load ordered
+        //only by acquire could be satisfied before the store of the flag
+        //becomes visible and miss a reader that has not seen the flag
+        writer_.store( true, boost::memory_order_seq_cst );
+        for( int i = 0; i != SLOTS; ++i )
+            while( readers_[ i ].count.load( boost::memory_order_seq_cst ) ) boost::this_thread::yield();
+    }
+    bool try_lock() {
+        if( !writers_.try_lock() ) return false;
+        writer_.store( true, boost::memory_order_seq_cst );
+        for( int i = 0; i != SLOTS; ++i ) {
+            if( readers_[ i ].count.load( boost::memory_order_seq_cst ) ) {
+                unlock();
+                return false;
+            }
+        }
+        return true;
+    }
+    void unlock() {
+        writer_.store( false, boost::memory_order_release );
+        writers_.unlock();
+    }
+private:
+    /// Counter index of calling thread; threads are assigned counters
+    /// round robin.
+    static int Slot() {
+        static boost::atomic< unsigned > next( 0 );
+        static thread_local const int slot =
+            int( next.fetch_add( 1, boost::memory_order_relaxed ) % SLOTS );
+        return slot;
+    }
+    /// Aligned so that each counter starts its own cache line, padded so
+    /// that no other data shares it.
+    struct alignas( CACHE_LINE_SIZE ) Readers {
+        boost::atomic< int > count;
+        char padding[ CACHE_LINE_SIZE - sizeof( boost::atomic< int > ) ];
+    };
+    Readers readers_[ SLOTS ];
+    boost::atomic< bool > writer_;
+    boost::mutex writers_;
+};
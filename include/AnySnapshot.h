@@ -0,0 +1,298 @@
+#pragma once
+//Author: Ugo Varetto
+
+/// @file AnySnapshot.h Storage snapshot files, see
+/// MultiAnyStorage::Snapshot and MapAnyStorage::Snapshot.
+///
+/// File layout, all offsets relative to the beginning of the file:
+///  - header: 8 byte magic, 32 bit version, 32 bit kind, 64 bit slot count
+///  - slot table: per slot 64 bit key offset, key size, value offset,
+///    value size
+///  - keys and values encoded with AnyCodec.h
+/// Map snapshots store keys sorted according to AnyCompare, multi value
+/// snapshots store no keys.
+/// Files are written to a temporary file, flushed to disk and renamed, so
+/// that an interrupted write leaves any previous file in place; requires
+/// POSIX file I/O.
+
+#include <cstring>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <boost/atomic.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Referenced.h"
+#include "AnyCodec.h"
+#include "AnyView.h"
+
+/// Kind of storage saved in snapshot.
+enum AnySnapshotKind {
+    ANY_SNAPSHOT_MULTI = 1,
+    ANY_SNAPSHOT_MAP = 2
+};
+
+/// Snapshot file header.
+struct AnySnapshotHeader {
+    char magic[ 8 ];
+    unsigned int version;
+    unsigned int kind;
+    unsigned long long count;
+};
+
+/// Location of encoded key and value.
+struct AnySnapshotSlot {
+    unsigned long long keyOffset;
+    unsigned long long keySize;
+    unsigned long long valueOffset;
+    unsigned long long valueSize;
+};
+
+//------------------------------------------------------------------------------
+/// @brief Read-only memory mapping of a snapshot file, shared by the
+/// storages opened from it and their clones.
+class AnySnapshotFile : public Referenced {
+public:
+    /// Map file, throws @c std::runtime_error if not a snapshot of kind
+    /// @c kind.
+    AnySnapshotFile( const std::string& path, AnySnapshotKind kind )
+        : file_( path.c_str(), boost::interprocess::read_only ),
+          region_( file_, boost::interprocess::read_only )
+    {
+        begin_ = static_cast< const char* >( region_.get_address() );
+        end_ = begin_ + region_.get_size();
+        AnySnapshotHeader h;
+        const char* p = begin_;
+        AnyCodecRead( p, end_, &h, sizeof( h ) );
+        if( std::memcmp( h.magic, MAGIC, sizeof( h.magic ) ) != 0 || h.version != 1
+            || h.kind != unsigned( kind ) )
+            throw std::runtime_error( "Invalid Any snapshot: " + path );
+        if( std::size_t( end_ - p ) / sizeof( AnySnapshotSlot ) < h.count )
+            throw std::runtime_error( "Truncated Any snapshot: " + path );
+        count_ = std::size_t( h.count );
+        slots_ = p;
+    }
+    /// Number of slots.
+    std::size_t Count() const { return count_; }
+    /// Location of slot @c i.
+    AnySnapshotSlot Slot( std::size_t i ) const
+    {
+        AnySnapshotSlot s;
+        std::memcpy( &s, slots_ + i * sizeof( s ), sizeof( s ) );
+        return s;
+    }
+    /// Encoded bytes at @c offset, throws @c std::runtime_error if out of
+    /// file.
+    const char* At( unsigned long long offset, unsigned long long size ) const
+    {
+        if( offset > std::size_t( end_ - begin_ ) || size > std::size_t( end_ - begin_ ) - offset )
+            throw std::runtime_error( "Truncated Any snapshot" );
+        return begin_ + offset;
+    }
+    /// View of key of slot @c i.
+    AnyView Key( std::size_t i ) const
+    {
+        const AnySnapshotSlot s = Slot( i );
+        const char* p = At( s.keyOffset, s.keySize );
+        return AnyView( p, p + s.keySize );
+    }
+    /// Decode value of slot @c i.
+    Any Value( std::size_t i ) const
+    {
+        const AnySnapshotSlot s = Slot( i );
+        const char* p = At( s.valueOffset, s.valueSize );
+        return AnyDecode( p, p + s.valueSize );
+    }
+    static constexpr const char* MAGIC = "ANYSNAP";
+private:
+    boost::interprocess::file_mapping file_;
+    boost::interprocess::mapped_region region_;
+    const char* begin_;
+    const char* end_;
+    const char* slots_;
+    std::size_t count_;
+};
+
+//------------------------------------------------------------------------------
+/// @brief Values of a snapshot decoded on first access: each slot has an
+/// atomic state so that concurrent readers decode it only once.
+class AnySnapshotCache {
+public:
+    AnySnapshotCache() : count_( 0 ) {}
+    /// Map snapshot file.
+    void Open( const std::string& path, AnySnapshotKind kind )
+    {
+        file_ = new AnySnapshotFile( path, kind );
+        count_ = file_->Count();
+        states_.reset( new boost::atomic< unsigned char >[ count_ ] );
+        for( std::size_t i = 0; i != count_; ++i ) states_[ i ].store( PENDING );
+    }
+    /// Copy decoding state, the mapping is shared.
+    void CopyFrom( const AnySnapshotCache& c )
+    {
+        file_ = c.file_;
+        count_ = c.count_;
+        states_.reset( count_ ? new boost::atomic< unsigned char >[ count_ ] : 0 );
+        for( std::size_t i = 0; i != count_; ++i )
+            states_[ i ].store( c.states_[ i ].load() == READY ? READY : PENDING );
+    }
+    /// Number of slots in snapshot, zero if none opened.
+    std::size_t Count() const { return count_; }
+    /// Mapped file.
+    const AnySnapshotFile& File() const { return *file_; }
+    /// Returns @c true if value of slot @c i has been decoded or set.
+    bool Loaded( std::size_t i ) const { return states_[ i ].load( boost::memory_order_acquire ) == READY; }
+    /// Decode value of slot @c i into @c dst unless already decoded; safe to
+    /// call concurrently for the same slot.
+    void Load( std::size_t i, Any& dst ) const
+    {
+        for( ;; ) {
+            unsigned char s = states_[ i ].load( boost::memory_order_acquire );
+            if( s == READY ) return;
+            if( s == PENDING && states_[ i ].compare_exchange_strong( s, LOADING,
+                                                                      boost::memory_order_acquire ) ) {
+                try {
+                    dst = file_->Value( i );
+                } catch( ... ) {
+                    states_[ i ].store( PENDING, boost::memory_order_release );
+                    throw;
+                }
+                states_[ i ].store( READY, boost::memory_order_release );
+                return;
+            }
+            boost::this_thread::yield();
+        }
+    }
+    /// Mark slot @c i as set by the owner of @c dst.
+    void SetLoaded( std::size_t i ) { states_[ i ].store( READY, boost::memory_order_release ); }
+    /// Decode all the values using @c threads threads.
+    void Preload( std::vector< Any >& values, unsigned threads ) const
+    {
+        if( threads < 2 ) {
+            for( std::size_t i = 0; i != count_; ++i ) Load( i, values[ i ] );
+            return;
+        }
+        boost::thread_group group;
+        for( unsigned t = 0; t != threads; ++t )
+            group.create_thread( [ this, &values, t, threads ]() {
+                PreloadRange( values, t, threads );
+            } );
+        group.join_all();
+    }
+private:
+    enum { PENDING, LOADING, READY };
+    void PreloadRange( std::vector< Any >& values, unsigned first, unsigned stride ) const
+    {
+        for( std::size_t i = first; i < count_; i += stride ) Load( i, values[ i ] );
+    }
+private:
+    boost::intrusive_ptr< AnySnapshotFile > file_;
+    std::size_t count_;
+    boost::scoped_array< boost::atomic< unsigned char > > states_;
+};
+
+//------------------------------------------------------------------------------
+/// @brief Sequential writer of snapshot files: slot table is written after
+/// the data when closing the file.
+/// Data is written to <path>.tmp, which replaces @c path when closing; the
+/// temporary file is removed if the writer is destroyed before Close().
+class AnySnapshotWriter {
+public:
+    /// Create temporary file for @c count slots, throws
+    /// @c std::runtime_error on failure.
+    AnySnapshotWriter( const std::string& path, AnySnapshotKind kind, std::size_t count )
+        : path_( path ), tmp_( path + ".tmp" ),
+          os_( tmp_.c_str(), std::ios::binary | std::ios::trunc ), kind_( kind ),
+          count_( count ), offset_( sizeof( AnySnapshotHeader ) + count * sizeof( AnySnapshotSlot ) ),
+          closed_( false )
+    {
+        if( !os_ ) throw std::runtime_error( "Cannot create Any snapshot: " + tmp_ );
+        slots_.reserve( count );
+        os_.seekp( std::streamoff( offset_ ) );
+    }
+    /// Append slot with encoded key and value.
+    void Add( const char* key, std::size_t keySize, const char* value, std::size_t valueSize )
+    {
+        AnySnapshotSlot s = { offset_, keySize, offset_ + keySize, valueSize };
+        os_.write( key, std::streamsize( keySize ) );
+        os_.write( value, std::streamsize( valueSize ) );
+        offset_ += keySize + valueSize;
+        slots_.push_back( s );
+    }
+    /// Append slot encoding value.
+    void Add( const char* key, std::size_t keySize, const Any& value )
+    {
+        buf_.clear();
+        AnyEncode( value, buf_ );
+        Add( key, keySize, buf_.data(), buf_.size() );
+    }
+    /// Append slot copying value of snapshot slot @c i without decoding it.
+    void Add( const char* key, std::size_t keySize, const AnySnapshotFile& f, std::size_t i )
+    {
+        const AnySnapshotSlot s = f.Slot( i );
+        Add( key, keySize, f.At( s.valueOffset, s.valueSize ), std::size_t( s.valueSize ) );
+    }
+    /// Remove temporary file if not closed.
+    ~AnySnapshotWriter()
+    {
+        if( closed_ ) return;
+        os_.close();
+        std::remove( tmp_.c_str() );
+    }
+    /// Write header and slot table, flush file to disk, rename it to the
+    /// final path and flush the directory entry; throws
+    /// @c std::runtime_error on failure.
+    void Close()
+    {
+        if( slots_.size() != count_ )
+            throw std::logic_error( "Any snapshot: wrong number of slots" );
+        AnySnapshotHeader h;
+        std::memcpy( h.magic, AnySnapshotFile::MAGIC, sizeof( h.magic ) );
+        h.version = 1;
+        h.kind = kind_;
+        h.count = slots_.size();
+        os_.seekp( 0 );
+        os_.write( reinterpret_cast< const char* >( &h ), sizeof( h ) );
+        if( !slots_.empty() )
+            os_.write( reinterpret_cast< const char* >( &slots_[ 0 ] ),
+                       std::streamsize( slots_.size() * sizeof( AnySnapshotSlot ) ) );
+        os_.close();
+        if( !os_ ) throw std::runtime_error( "Error writing Any snapshot: " + tmp_ );
+        Sync( tmp_, O_RDONLY );
+        if( std::rename( tmp_.c_str(), path_.c_str() ) != 0 )
+            throw std::runtime_error( "Cannot rename Any snapshot: " + tmp_ );
+        closed_ = true;
+        const std::string::size_type slash = path_.rfind( '/' );
+        Sync( slash == std::string::npos ? "." : slash == 0 ? "/" : path_.substr( 0, slash ),
+              O_RDONLY | O_DIRECTORY );
+    }
+private:
+    /// Flush file or directory to disk.
+    static void Sync( const std::string& path, int flags )
+    {
+        const int fd = ::open( path.c_str(), flags );
+        if( fd < 0 ) throw std::runtime_error( "Cannot open for syncing: " + path );
+        const int r = ::fsync( fd );
+        ::close( fd );
+        if( r != 0 ) throw std::runtime_error( "Error syncing: " + path );
+    }
+private:
+    std::string path_;
+    std::string tmp_;
+    std::ofstream os_;
+    AnySnapshotKind kind_;
+    std::size_t count_;
+    unsigned long long offset_;
+    std::vector< AnySnapshotSlot > slots_;
+    std::vector< char > buf_;
+    bool closed_;
+};
@@ -3,38 +3,82 @@
 
 #include <vector>
 #include <map>
+#include <set>
+#include <functional>
+#include <stdexcept>
+#include <new>
 #include <boost/utility.hpp>
 #include <typeinfo>
 #include <boost/thread.hpp>
+#include <boost/align/aligned_alloc.hpp>
 
 #include <Referenced.h>
 #include <ICloneable.h>
 #include <Any.h>
+#include <AnySnapshot.h>
+#include <AnyRWMutex.h>
+
+/// Define to reject at compile time keys of types which cannot be ordered
+/// (see @c AnyIsOrdered) when passed with their static type to
+/// MapAnyStorage::Put, instead of failing with @c std::runtime_error when the
+/// storage is queried.
+#ifdef ANY_STATIC_KEY_CHECK
+#define ANY_CHECK_KEY_TYPE( KeyT ) \
+    static_assert( AnyIsOrdered< KeyT >::Value, \
+                   "Key type not supported by AnyLess" )
+#else
+#define ANY_CHECK_KEY_TYPE( KeyT )
+#endif
 
 struct IAnyStorage : Referenced,
                      ICloneable< IAnyStorage > {
+    /// Function receiving key and value of stored elements.
+    typedef std::function< void ( const Any&, const Any& ) > Visitor;
     virtual const Any& Get( const Any& key = Any() ) const = 0;
     virtual Any Put( const Any& value, const Any& key = Any() ) = 0;
+    /// Move value into storage; by default the value is copied.
+    virtual Any Put( Any&& value, const Any& key = Any() ) {
+        return Put( static_cast< const Any& >( value ), key );
+    }
+    /// Construct a value of type @c T from @c args and move it into storage.
+    template < class T, class... ArgsT >
+    Any Emplace( const Any& key, ArgsT&&... args ) {
+        Any value;
+        value.Emplace< T >( std::forward< ArgsT >( args )... );
+        return Put( std::move( value ), key );
+    }
     virtual IAnyStorage* Clone() const = 0;
     virtual const std::type_info& KeyType() const = 0;
+    /// Invoke @c visitor on each stored key and value, in key order for
+    /// ordered storages; by default throws @c std::logic_error.
+    virtual void Visit( const Visitor& ) const {
+        throw std::logic_error( "Visit not supported" );
+    }
     virtual ~IAnyStorage() {}
 };
 
 class SingleAnyStorage : public IAnyStorage {
 public:
-    virtual const Any& Get( const Any& key = Any() ) const {
+    virtual const Any& Get( const Any& = Any() ) const {
         return anyVal_;
     }
-    virtual Any Put( const Any& value, const Any& key = Any() ) {
+    virtual Any Put( const Any& value, const Any& = Any() ) {
         anyVal_ = value;
         return Any();
     }
+    virtual Any Put( Any&& value, const Any& = Any() ) {
+        anyVal_ = std::move( value );
+        return Any();
+    }
     virtual SingleAnyStorage* Clone() const { 
         SingleAnyStorage* sp = new SingleAnyStorage;
         sp->anyVal_ = anyVal_;
         return sp;
     }
     virtual const std::type_info& KeyType() const { return typeid( Any() ); }
+    virtual void Visit( const Visitor& visitor ) const {
+        if( !anyVal_.Empty() ) visitor( Any(), anyVal_ );
+    }
 private:
     Any anyVal_;
 };
@@ -46,26 +90,72 @@ public:
     typedef AnyVector::size_type Key;
 
     virtual const Any& Get( const Any& key = Any() ) const {
-        return anyArray_[ key ];
+        const AnyVector::size_type k = AnyVector::size_type( Key( key ) );
+        if( k < snapshot_.Count() ) snapshot_.Load( k, anyArray_[ k ] );
+        return anyArray_[ k ];
     }
     virtual Any Put( const Any& value, const Any& key = Any() ) {
+        return Put( Any( value ), key );
+    }
+    virtual Any Put( Any&& value, const Any& key = Any() ) {
         if( key.Empty() ) {
-            anyArray_.push_back( value );
+            anyArray_.push_back( std::move( value ) );
             return Key( anyArray_.size() - 1 );
         }
         const AnyVector::size_type k = AnyVector::size_type( Key( key ) );
-        if( k >= anyArray_.size() ) anyArray_.resize( k );
-        anyArray_[ key ] = value;
+        if( k >= anyArray_.size() ) anyArray_.resize( k + 1 );
+        anyArray_[ k ] = std::move( value );
+        if( k < snapshot_.Count() ) snapshot_.SetLoaded( k );
         return key;
     }
     virtual MultiAnyStorage* Clone() const { 
         MultiAnyStorage* mp = new MultiAnyStorage;
         mp->anyArray_ = anyArray_;
+        mp->snapshot_.CopyFrom( snapshot_ );
         return mp;
     }
     virtual const std::type_info& KeyType() const { return typeid( Key ); }
+    virtual void Visit( const Visitor& visitor ) const {
+        for( AnyVector::size_type i = 0; i != anyArray_.size(); ++i )
+            visitor( Key( i ), Get( Key( i ) ) );
+    }
+    /// Number of slots.
+    std::size_t Size() const { return anyArray_.size(); }
+    /// Write values to snapshot file, see AnySnapshot.h; values must be of
+    /// types registered with the codec (see AnyCodec.h), values read from
+    /// a snapshot and not accessed yet are copied without decoding them.
+    /// @c path can be the file this storage was opened from, which stays
+    /// mapped until the storage is destroyed.
+    void Snapshot( const std::string& path ) const {
+        AnySnapshotWriter w( path, ANY_SNAPSHOT_MULTI, anyArray_.size() );
+        for( AnyVector::size_type i = 0; i != anyArray_.size(); ++i ) {
+            if( i < snapshot_.Count() && !snapshot_.Loaded( i ) ) w.Add( 0, 0, snapshot_.File(), i );
+            else w.Add( 0, 0, anyArray_[ i ] );
+        }
+        w.Close();
+    }
+    /// Create storage from snapshot file mapped in memory: values are decoded
+    /// on first access, concurrent Get calls are supported.
+    static MultiAnyStorage* Open( const std::string& path ) {
+        MultiAnyStorage* mp = new MultiAnyStorage;
+        try {
+            mp->snapshot_.Open( path, ANY_SNAPSHOT_MULTI );
+            mp->anyArray_.resize( mp->snapshot_.Count() );
+        } catch( ... ) {
+            delete mp;
+            throw;
+        }
+        return mp;
+    }
+    /// Decode the values read from snapshot and not accessed yet, using
+    /// @c threads threads.
+    void Preload( unsigned threads = boost::thread::hardware_concurrency() ) const {
+        snapshot_.Preload( anyArray_, threads );
+    }
 private:
-    AnyVector anyArray_;
+    /// Mutable because values read from snapshot are decoded on first access.
+    mutable AnyVector anyArray_;
+    AnySnapshotCache snapshot_;
 };
 
 class MapAnyStorage : public IAnyStorage {
@@ -73,27 +163,184 @@ public:
     typedef std::map< Any, Any > AnyMap;
     typedef AnyMap::key_type Key;
     typedef AnyMap::const_iterator ConstIterator;
+    typedef std::vector< std::pair< Any, Any > > Changes;
+
+    MapAnyStorage() : shadowed_( 0 ), trackChanges_( false ) {}
 
     virtual const Any& Get( const Any& key = Any() ) const {
         ConstIterator ci = anyMap_.find( key );
         if( ci != anyMap_.end() ) return ci->second;
+        const std::size_t i = FindInSnapshot( key );
+        if( i != snapshot_.Count() ) {
+            snapshot_.Load( i, snapshotValues_[ i ] );
+            return snapshotValues_[ i ];
+        }
         return emptyAny_;
     }
     virtual Any Put( const Any& value, const Any& key = Any() ) {
-        anyMap_[ key ] = value;
+        Insert( key ) = value;
+        if( trackChanges_ ) changed_.insert( key );
+        return key;
+    }
+    virtual Any Put( Any&& value, const Any& key = Any() ) {
+        Insert( key ) = std::move( value );
+        if( trackChanges_ ) changed_.insert( key );
         return key;
     }
+    /// Put value with key of static type @c KeyT, see ANY_STATIC_KEY_CHECK.
+    template < class KeyT >
+    typename std::enable_if< !std::is_same< KeyT, Any >::value, Any >::type
+    Put( const Any& value, const KeyT& key ) {
+        ANY_CHECK_KEY_TYPE( KeyT );
+        return Put( value, Any( key ) );
+    }
+    /// Move value with key of static type @c KeyT, see ANY_STATIC_KEY_CHECK.
+    template < class KeyT >
+    typename std::enable_if< !std::is_same< KeyT, Any >::value, Any >::type
+    Put( Any&& value, const KeyT& key ) {
+        ANY_CHECK_KEY_TYPE( KeyT );
+        return Put( std::move( value ), Any( key ) );
+    }
     virtual MapAnyStorage* Clone() const { 
         MapAnyStorage* mp = new MapAnyStorage;
         mp->anyMap_ = anyMap_;
+        mp->snapshot_.CopyFrom( snapshot_ );
+        //slots being decoded by concurrent Get calls are pending in the copy
+        mp->snapshotValues_.resize( snapshotValues_.size() );
+        for( std::size_t i = 0; i != snapshotValues_.size(); ++i )
+            if( mp->snapshot_.Loaded( i ) ) mp->snapshotValues_[ i ] = snapshotValues_[ i ];
+        mp->shadowed_ = shadowed_;
+        mp->changed_ = changed_;
+        mp->trackChanges_ = trackChanges_;
         return mp;
     }
+    /// Number of keys, including the ones read from snapshot.
+    std::size_t Size() const { return anyMap_.size() + snapshot_.Count() - shadowed_; }
+    /// Start or stop recording the keys passed to Put, see TakeChanges.
+    void TrackChanges( bool on = true ) {
+        trackChanges_ = on;
+        if( !on ) changed_.clear();
+    }
+    /// @c true if keys passed to Put are recorded, see TrackChanges.
+    bool TrackingChanges() const { return trackChanges_; }
+    /// Return keys and values put since change tracking was enabled or
+    /// since the previous call, sorted by key, and clear the recorded keys;
+    /// takes time proportional to the number of changed keys.
+    Changes TakeChanges() {
+        Changes changes;
+        changes.reserve( changed_.size() );
+        for( std::set< Key >::const_iterator i = changed_.begin();
+             i != changed_.end(); ++i )
+            changes.push_back( std::make_pair( *i, anyMap_.find( *i )->second ) );
+        changed_.clear();
+        return changes;
+    }
     virtual const std::type_info& KeyType() const { 
         return anyMap_.empty() ? typeid( Key ) : typeid( anyMap_.begin()->first );
     }
+    /// Visit elements in key order; values read from snapshot and not
+    /// accessed yet are decoded into temporaries.
+    virtual void Visit( const Visitor& visitor ) const {
+        ConstIterator m = anyMap_.begin();
+        for( std::size_t i = 0; i != snapshot_.Count(); ++i ) {
+            const Any k = snapshot_.File().Key( i ).ToAny();
+            for( ; m != anyMap_.end() && AnyCompare( m->first, k ) <= 0; ++m )
+                visitor( m->first, m->second );
+            if( anyMap_.find( k ) != anyMap_.end() ) continue;
+            if( snapshot_.Loaded( i ) ) visitor( k, snapshotValues_[ i ] );
+            else visitor( k, snapshot_.File().Value( i ) );
+        }
+        for( ; m != anyMap_.end(); ++m ) visitor( m->first, m->second );
+    }
+    /// Write keys and values to snapshot file, see AnySnapshot.h; keys and
+    /// values must be of types registered with the codec (see AnyCodec.h),
+    /// values read from a snapshot and not accessed yet are copied without
+    /// decoding them.
+    /// @c path can be the file this storage was opened from, which stays
+    /// mapped until the storage is destroyed.
+    void Snapshot( const std::string& path ) const {
+        //keys read from snapshot and not replaced by Put, already sorted
+        std::vector< std::pair< Any, std::size_t > > old;
+        for( std::size_t i = 0; i != snapshot_.Count(); ++i ) {
+            Any k = snapshot_.File().Key( i ).ToAny();
+            if( anyMap_.find( k ) == anyMap_.end() ) old.push_back( std::make_pair( std::move( k ), i ) );
+        }
+        AnySnapshotWriter w( path, ANY_SNAPSHOT_MAP, old.size() + anyMap_.size() );
+        std::vector< char > kb;
+        ConstIterator m = anyMap_.begin();
+        std::vector< std::pair< Any, std::size_t > >::const_iterator o = old.begin();
+        while( m != anyMap_.end() || o != old.end() ) {
+            if( o == old.end() || ( m != anyMap_.end() && AnyCompare( m->first, o->first ) < 0 ) ) {
+                kb.clear();
+                AnyEncode( m->first, kb );
+                w.Add( kb.data(), kb.size(), m->second );
+                ++m;
+                continue;
+            }
+            const AnySnapshotSlot s = snapshot_.File().Slot( o->second );
+            const char* k = snapshot_.File().At( s.keyOffset, s.keySize );
+            if( snapshot_.Loaded( o->second ) )
+                w.Add( k, std::size_t( s.keySize ), snapshotValues_[ o->second ] );
+            else w.Add( k, std::size_t( s.keySize ), snapshot_.File(), o->second );
+            ++o;
+        }
+        w.Close();
+    }
+    /// Create storage from snapshot file mapped in memory: keys are searched
+    /// in the mapped file and values decoded on first access, concurrent Get
+    /// calls are supported.
+    static MapAnyStorage* Open( const std::string& path ) {
+        MapAnyStorage* mp = new MapAnyStorage;
+        try {
+            mp->snapshot_.Open( path, ANY_SNAPSHOT_MAP );
+            mp->snapshotValues_.resize( mp->snapshot_.Count() );
+        } catch( ... ) {
+            delete mp;
+            throw;
+        }
+        return mp;
+    }
+    /// Decode the values read from snapshot and not accessed yet, using
+    /// @c threads threads.
+    void Preload( unsigned threads = boost::thread::hardware_concurrency() ) const {
+        snapshot_.Preload( snapshotValues_, threads );
+    }
+private:
+    /// Return reference to value of key, inserting it if not found.
+    Any& Insert( const Any& key ) {
+        const std::size_t n = anyMap_.size();
+        Any& v = anyMap_[ key ];
+        if( anyMap_.size() != n && snapshot_.Count()
+            && FindInSnapshot( key ) != snapshot_.Count() ) ++shadowed_;
+        return v;
+    }
+    /// Return index of key in snapshot, number of snapshot slots if not
+    /// found.
+    std::size_t FindInSnapshot( const Any& key ) const {
+        if( snapshot_.Count() == 0 ) return 0;
+        const std::vector< char > kb = AnyEncode( key );
+        const AnyView k( kb );
+        std::size_t lo = 0, hi = snapshot_.Count();
+        while( lo < hi ) {
+            const std::size_t mid = lo + ( hi - lo ) / 2;
+            const int r = AnyCompare( snapshot_.File().Key( mid ), k );
+            if( r == 0 ) return mid;
+            if( r < 0 ) lo = mid + 1;
+            else hi = mid;
+        }
+        return snapshot_.Count();
+    }
 private:
     AnyMap anyMap_;
     Any emptyAny_;
+    /// Values read from snapshot, decoded on first access.
+    mutable std::vector< Any > snapshotValues_;
+    AnySnapshotCache snapshot_;
+    /// Number of keys both in map and snapshot.
+    std::size_t shadowed_;
+    /// Keys put since last call to TakeChanges.
+    std::set< Key > changed_;
+    bool trackChanges_;
 };
 
 
@@ -111,11 +358,14 @@ public:
         return storage_->Get( key );
     }
     virtual Any Put( const Any& value, const Any& key = Any() ) {
+        return Put( Any( value ), key );
+    }
+    virtual Any Put( Any&& value, const Any& key = Any() ) {
         data_ready_ = false;
         Any k;
         {
             boost::lock_guard< boost::mutex > lock( mutex_ );
-            k = storage_->Put( value, key );
+            k = storage_->Put( std::move( value ), key );
             data_ready_ = true;
         }
         cond_.notify_one();
@@ -124,10 +374,16 @@ public:
     virtual ThisType* Clone() const {
         boost::lock_guard< boost::mutex > lock( mutex_ );
         ThisType* tt = new ThisType;
-        tt->storage_ = tt->storage_->Clone();
+        delete tt->storage_;
+        tt->storage_ = storage_->Clone();
+        tt->data_ready_ = data_ready_;
         return tt;
     }
     virtual const std::type_info& KeyType() const { return storage_->KeyType(); }
+    virtual void Visit( const Visitor& visitor ) const {
+        boost::lock_guard< boost::mutex > lock( mutex_ );
+        storage_->Visit( visitor );
+    }
     ~SyncAnyStorage() { delete storage_; }
 private:
     mutable boost::condition_variable cond_;
@@ -135,3 +391,77 @@ private:
     bool data_ready_;
     StorageType* storage_;
 };
+
+/// Synchronized storage allowing concurrent readers: Get, KeyType and Visit
+/// take a shared lock, Put an exclusive lock. As with SyncAnyStorage, Get
+/// waits until the first value is put.
+/// @c MutexT must model SharedLockable, e.g. AnyRWMutex or
+/// @c boost::shared_mutex; @c AnyStorageT must support concurrent calls to
+/// const methods.
+template < typename AnyStorageT, typename MutexT = AnyRWMutex >
+class RWSyncAnyStorage : public IAnyStorage {
+public:
+    typedef AnyStorageT StorageType;
+    typedef MutexT MutexType;
+    typedef RWSyncAnyStorage< AnyStorageT, MutexT > ThisType;
+
+    RWSyncAnyStorage() : data_ready_( false ), storage_( new StorageType ) {}
+
+    virtual const Any& Get( const Any& key = Any() ) const {
+        if( !data_ready_.load( boost::memory_order_acquire ) ) {
+            boost::unique_lock< boost::mutex > lock( ready_mutex_ );
+            while( !data_ready_.load( boost::memory_order_acquire ) ) cond_.wait( lock );
+        }
+        boost::shared_lock< MutexType > lock( mutex_ );
+        return storage_->Get( key );
+    }
+    virtual Any Put( const Any& value, const Any& key = Any() ) {
+        return Put( Any( value ), key );
+    }
+    virtual Any Put( Any&& value, const Any& key = Any() ) {
+        Any k;
+        {
+            boost::unique_lock< MutexType > lock( mutex_ );
+            k = storage_->Put( std::move( value ), key );
+        }
+        if( !data_ready_.load( boost::memory_order_acquire ) ) {
+            {
+                boost::lock_guard< boost::mutex > lock( ready_mutex_ );
+                data_ready_.store( true, boost::memory_order_release );
+            }
+            cond_.notify_all();
+        }
+        return k;
+    }
+    virtual ThisType* Clone() const {
+        boost::shared_lock< MutexType > lock( mutex_ );
+        ThisType* tt = new ThisType;
+        delete tt->storage_;
+        tt->storage_ = storage_->Clone();
+        tt->data_ready_.store( data_ready_.load( boost::memory_order_acquire ) );
+        return tt;
+    }
+    virtual const std::type_info& KeyType() const {
+        boost::shared_lock< MutexType > lock( mutex_ );
+        return storage_->KeyType();
+    }
+    virtual void Visit( const Visitor& visitor ) const {
+        boost::shared_lock< MutexType > lock( mutex_ );
+        storage_->Visit( visitor );
+    }
+    ~RWSyncAnyStorage() { delete storage_; }
+    /// Allocate with the alignment of the mutex, e.g. the cache line
+    /// alignment of AnyRWMutex, not guaranteed by operator new before C++17.
+    static void* operator new( std::size_t size ) {
+        void* p = boost::alignment::aligned_alloc( alignof( ThisType ), size );
+        if( !p ) throw std::bad_alloc();
+        return p;
+    }
+    static void operator delete( void* p ) { boost::alignment::aligned_free( p ); }
+private:
+    mutable MutexType mutex_;
+    mutable boost::condition_variable cond_;
+    mutable boost::mutex ready_mutex_;
+    boost::atomic< bool > data_ready_;
+    StorageType* storage_;
+};
@@ -0,0 +1,237 @@
+#pragma once
+//Author: Ugo Varetto
+
+/// @file AnyView.h Read-only access to values encoded by AnyCodec.h.
+
+#include <cstring>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <typeinfo>
+#include <stdexcept>
+#include <type_traits>
+#include <algorithm>
+
+#include "AnyCodec.h"
+
+//------------------------------------------------------------------------------
+/// @brief Read-only view of an encoded value, see AnyCodec.h: the view
+/// refers to the encoded bytes, which must outlive it, and decodes only the
+/// data accessed. Elements of encoded vectors are reached through the
+/// offset table without decoding the preceding elements.
+/// Types are resolved through the global codec registry.
+/// @ingroup utility
+class AnyView {
+public:
+    /// Default constructor: creates empty view.
+    AnyView() : begin_( 0 ), end_( 0 ), code_( ANY_CODE_EMPTY ) {}
+    /// View of value encoded at the beginning of [@c begin, @c end), throws
+    /// @c std::runtime_error if the buffer is too small to contain a value.
+    AnyView( const char* begin, const char* end )
+        : begin_( begin ), end_( end )
+    {
+        AnyCodecRead( begin_, end_, &code_, sizeof( code_ ) );
+    }
+    /// View of value encoded in buffer.
+    explicit AnyView( const std::vector< char >& buf ) : begin_( 0 ), end_( 0 ), code_( ANY_CODE_EMPTY )
+    {
+        const char* p = buf.empty() ? 0 : &buf[ 0 ];
+        *this = AnyView( p, p + buf.size() );
+    }
+public:
+    /// Returns @c true if encoded value empty.
+    bool Empty() const { return code_ == ANY_CODE_EMPTY; }
+    /// Returns code of encoded type.
+    AnyCode Code() const { return code_; }
+    /// Returns type of encoded value, Any::EMPTY_ if empty.
+    const std::type_info& Type() const
+    {
+        return !Empty() ? *Entry().type : typeid( Any::EMPTY_ );
+    }
+    /// Returns identifier of encoded type, the same returned by Any::TypeId().
+    AnyTypeId TypeId() const
+    {
+        return !Empty() ? Entry().id : AnyTypeIdOf< Any::EMPTY_ >();
+    }
+    /// Returns @c true if encoded value is of type @c T.
+    template < class T > bool Is() const
+    {
+        const AnyCodecEntry* e = AnyCodecs().FindType( AnyTypeIdOf< T >(), typeid( T ) );
+        return e != 0 && e->code == code_;
+    }
+    /// Returns address of payload: bytes of fixed size values, characters
+    /// of strings, offset table of vectors.
+    const char* Data() const
+    {
+        return IsSized() ? begin_ + sizeof( unsigned int ) : begin_;
+    }
+    /// Returns number of characters of strings, of elements of vectors,
+    /// of bytes of other values.
+    std::size_t Size() const
+    {
+        if( IsSized() ) {
+            const char* p = begin_;
+            return AnyCodecReadSize( p, end_ );
+        }
+        return Empty() ? 0 : Entry().size;
+    }
+    /// Returns view of element @c i of encoded vector, throws
+    /// @c std::out_of_range if @c i not less than Size() and
+    /// @c std::logic_error if not a vector.
+    AnyView operator[]( std::size_t i ) const
+    {
+        CheckType< std::vector< Any > >();
+        const std::size_t n = Size();
+        if( std::size_t( end_ - Data() ) / sizeof( unsigned int ) < n )
+            throw std::runtime_error( "Any decoding: truncated buffer" );
+        if( i >= n ) throw std::out_of_range( "AnyView: index out of range" );
+        const char* p = Data() + i * sizeof( unsigned int );
+        const std::size_t offset = AnyCodecReadSize( p, end_ );
+        const char* elements = Data() + n * sizeof( unsigned int );
+        if( std::size_t( end_ - elements ) < offset )
+            throw std::runtime_error( "Any decoding: truncated buffer" );
+        return AnyView( elements + offset, end_ );
+    }
+    /// Return copy of encoded value of type @c T, throws @c std::logic_error
+    /// if value not of type @c T. Fixed size values and strings are read
+    /// directly, other types are decoded into an Any instance first.
+    template < class T > T Get() const
+    {
+        CheckType< T >();
+        return Read< T >( typename ReadMode< T >::Type() );
+    }
+    /// Decode value.
+    Any ToAny() const
+    {
+        if( !begin_ ) return Any();
+        const char* p = begin_ - sizeof( code_ );
+        return AnyDecode( p, end_ );
+    }
+    /// Check if encoded value is of type @c T.
+    template < class T > void CheckType() const
+    {
+#if ANY_CHECK_TYPE
+        if( !Is< T >() )
+            throw std::logic_error(
+                    ( std::string( " Attempt to convert from ")
+                    + Type().name()
+                    + std::string( " to " )
+                    + typeid( T ).name() ).c_str() );
+#else
+        assert( Is< T >() );
+#endif
+    }
+    /// Equality with value of type @c T.
+    template < class T > bool operator==( const T& v ) const
+    {
+        return Get< T >() == v;
+    }
+    /// Three-way comparison of encoded values: numbers and strings are
+    /// compared in place, vectors element by element, other types after
+    /// decoding with AnyCompare; throws @c std::logic_error if types differ
+    /// or values are empty.
+    friend int AnyCompare( const AnyView& v1, const AnyView& v2 )
+    {
+        if( v1.code_ != v2.code_ )
+            throw std::logic_error(
+                    ( std::string( " Attempt to convert between ")
+                    + v1.Type().name()
+                    + std::string( " and " )
+                    + v2.Type().name() ).c_str() );
+        switch( v1.code_ ) {
+        case ANY_CODE_EMPTY: throw std::logic_error( "Attempt to compare empty values" );
+        case ANY_CODE_BOOL: return v1.ComparePod< bool >( v2 );
+        case ANY_CODE_CHAR: return v1.ComparePod< char >( v2 );
+        case ANY_CODE_SIGNED_CHAR: return v1.ComparePod< signed char >( v2 );
+        case ANY_CODE_UNSIGNED_CHAR: return v1.ComparePod< unsigned char >( v2 );
+        case ANY_CODE_SHORT: return v1.ComparePod< short >( v2 );
+        case ANY_CODE_UNSIGNED_SHORT: return v1.ComparePod< unsigned short >( v2 );
+        case ANY_CODE_INT: return v1.ComparePod< int >( v2 );
+        case ANY_CODE_UNSIGNED_INT: return v1.ComparePod< unsigned int >( v2 );
+        case ANY_CODE_LONG: return v1.ComparePod< long >( v2 );
+        case ANY_CODE_UNSIGNED_LONG: return v1.ComparePod< unsigned long >( v2 );
+        case ANY_CODE_LONG_LONG: return v1.ComparePod< long long >( v2 );
+        case ANY_CODE_UNSIGNED_LONG_LONG: return v1.ComparePod< unsigned long long >( v2 );
+        case ANY_CODE_FLOAT: return v1.ComparePod< float >( v2 );
+        case ANY_CODE_DOUBLE: return v1.ComparePod< double >( v2 );
+        case ANY_CODE_STRING: return v1.CompareString( v2 );
+        case ANY_CODE_VECTOR: return v1.CompareVector( v2 );
+        default: return AnyCompare( v1.ToAny(), v2.ToAny() );
+        }
+    }
+    /// Less than operator
+    friend bool operator<( const AnyView& v1, const AnyView& v2 ) { return AnyCompare( v1, v2 ) < 0; }
+    /// Greater than operator
+    friend bool operator>( const AnyView& v1, const AnyView& v2 ) { return AnyCompare( v1, v2 ) > 0; }
+    /// Equality operator
+    friend bool operator==( const AnyView& v1, const AnyView& v2 ) { return AnyCompare( v1, v2 ) == 0; }
+    /// Inequality operator
+    friend bool operator!=( const AnyView& v1, const AnyView& v2 ) { return AnyCompare( v1, v2 ) != 0; }
+private:
+    struct PodRead {};
+    struct StringRead {};
+    struct DecodeRead {};
+    template < class T > struct ReadMode {
+        typedef typename std::conditional< std::is_same< T, std::string >::value, StringRead,
+                    typename std::conditional< std::is_trivially_copyable< T >::value, PodRead,
+                        DecodeRead >::type >::type Type;
+    };
+    template < class T > T Read( PodRead ) const
+    {
+        if( Entry().size != sizeof( T ) ) return Read< T >( DecodeRead() );
+        T v;
+        const char* p = begin_;
+        AnyCodecRead( p, end_, &v, sizeof( v ) );
+        return v;
+    }
+    template < class T > T Read( StringRead ) const
+    {
+        const std::size_t n = Size();
+        if( std::size_t( end_ - Data() ) < n )
+            throw std::runtime_error( "Any decoding: truncated buffer" );
+        return std::string( Data(), n );
+    }
+    template < class T > T Read( DecodeRead ) const
+    {
+        return AnyVal< T >( ToAny() );
+    }
+    template < class T > int ComparePod( const AnyView& v ) const
+    {
+        return AnyCompare( Read< T >( PodRead() ), v.Read< T >( PodRead() ) );
+    }
+    int CompareString( const AnyView& v ) const
+    {
+        const std::size_t n1 = Size(), n2 = v.Size();
+        if( std::size_t( end_ - Data() ) < n1 || std::size_t( v.end_ - v.Data() ) < n2 )
+            throw std::runtime_error( "Any decoding: truncated buffer" );
+        const int r = std::char_traits< char >::compare( Data(), v.Data(), std::min( n1, n2 ) );
+        return r != 0 ? r : ( n2 < n1 ) - ( n1 < n2 );
+    }
+    int CompareVector( const AnyView& v ) const
+    {
+        const std::size_t n1 = Size(), n2 = v.Size();
+        for( std::size_t i = 0; i != std::min( n1, n2 ); ++i ) {
+            const int r = AnyCompare( ( *this )[ i ], v[ i ] );
+            if( r != 0 ) return r;
+        }
+        return ( n2 < n1 ) - ( n1 < n2 );
+    }
+    /// Return @c true if payload starts with a 32 bit size.
+    bool IsSized() const
+    {
+        return code_ == ANY_CODE_STRING || code_ == ANY_CODE_VECTOR;
+    }
+    /// Return registry entry of non-empty value.
+    const AnyCodecEntry& Entry() const
+    {
+        const AnyCodecEntry* e = AnyCodecs().FindCode( code_ );
+        if( !e ) throw std::runtime_error( "Any decoding: unknown type code" );
+        return *e;
+    }
+private:
+    /// Address of payload.
+    const char* begin_;
+    /// End of buffer.
+    const char* end_;
+    AnyCode code_;
+};
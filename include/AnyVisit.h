@@ -0,0 +1,147 @@
+#pragma once
+//Author: Ugo Varetto
+
+/// @file AnyVisit.h Constant time dispatch on the type of Any values.
+
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+#include "Any.h"
+
+//------------------------------------------------------------------------------
+/// @brief Map from type identifier to the position of the type in the list
+/// @c Ts, implemented as an open addressing hash table with at least twice
+/// as many slots as types, built on first use.
+/// @ingroup utility
+template < class... Ts >
+class AnyTypeIndex {
+public:
+    enum { SIZE = sizeof...( Ts ) };
+    /// Return position in type list of the type with identifier @c id,
+    /// @c SIZE if not in list.
+    static std::size_t Find( AnyTypeId id ) {
+        const Table& t = GetTable();
+        for( std::size_t i = Hash( id ); ; i = ( i + 1 ) & ( CAPACITY - 1 ) ) {
+            if( t.slots[ i ].index == SIZE || t.slots[ i ].id == id )
+                return t.slots[ i ].index;
+        }
+    }
+private:
+    static constexpr std::size_t Capacity( std::size_t c ) {
+        return c >= 2 * SIZE ? c : Capacity( 2 * c );
+    }
+    enum { CAPACITY = Capacity( 2 ) };
+    static std::size_t Hash( AnyTypeId id ) {
+        return std::size_t( id ^ ( id >> 32 ) ) & ( CAPACITY - 1 );
+    }
+    struct Slot {
+        AnyTypeId id;
+        std::size_t index;
+    };
+    struct Table {
+        Slot slots[ CAPACITY ];
+        Table() {
+            for( std::size_t i = 0; i != CAPACITY; ++i ) {
+                slots[ i ].id = 0;
+                slots[ i ].index = SIZE;
+            }
+            const AnyTypeId ids[] = { AnyTypeIdOf< Ts >()... };
+            for( std::size_t t = 0; t != SIZE; ++t ) {
+                std::size_t i = Hash( ids[ t ] );
+                while( slots[ i ].index != SIZE && slots[ i ].id != ids[ t ] )
+                    i = ( i + 1 ) & ( CAPACITY - 1 );
+                if( slots[ i ].index != SIZE ) continue; //duplicate type
+                slots[ i ].id = ids[ t ];
+                slots[ i ].index = t;
+            }
+        }
+    };
+    static const Table& GetTable() {
+        static const Table table;
+        return table;
+    }
+};
+
+/// Invoke visitor on value of type @c T contained in @c any, on @c any
+/// itself if the value is not of type @c T.
+template < class T, class R, class AnyT, class VisitorT >
+R AnyVisitCall( AnyT& any, VisitorT& visitor ) {
+    auto p = AnyCast< T >( &any );
+    return p ? visitor( *p ) : visitor( any );
+}
+
+/// Invoke visitor on @c any.
+template < class R, class AnyT, class VisitorT >
+R AnyVisitFallback( AnyT& any, VisitorT& visitor ) {
+    return visitor( any );
+}
+
+/// Table of functions invoking a visitor on each type in @c Ts, followed
+/// by the fallback invoking the visitor on the @c Any instance.
+template < class R, class AnyT, class VisitorT, class... Ts >
+struct AnyVisitTable {
+    typedef R ( *Thunk )( AnyT&, VisitorT& );
+    static constexpr Thunk thunks[] = { &AnyVisitCall< Ts, R, AnyT, VisitorT >...,
+                                        &AnyVisitFallback< R, AnyT, VisitorT > };
+    static R Visit( AnyT& any, VisitorT& visitor ) {
+        return thunks[ AnyTypeIndex< Ts... >::Find( any.TypeId() ) ]( any, visitor );
+    }
+};
+
+template < class R, class AnyT, class VisitorT, class... Ts >
+constexpr typename AnyVisitTable< R, AnyT, VisitorT, Ts... >::Thunk
+    AnyVisitTable< R, AnyT, VisitorT, Ts... >::thunks[];
+
+/// Invoke @c visitor on the value contained in @c any if its type is one of
+/// @c Ts, on @c any itself otherwise, including when @c any is empty.
+/// Dispatch takes constant time: the type identifier of the contained value
+/// is looked up in a hash table mapping identifiers to the entries of a
+/// jump table. The visitor must be callable with a reference to each type in
+/// @c Ts and with a reference to @c Any; the return type is the one of the
+/// call with @c Any.
+/// A shared value is detached (copied) before passing a non-const reference
+/// to the visitor, see AnyCast; visit a const @c Any to avoid the copy.
+/// Usage:
+/// @code
+/// struct Print {
+///     void operator()( int i ) const { std::cout << "int " << i; }
+///     void operator()( const std::string& s ) const { std::cout << s; }
+///     void operator()( const Any& ) const { std::cout << "?"; }
+/// };
+/// AnyVisit< int, std::string >( any, Print() );
+/// @endcode
+template < class... Ts, class VisitorT >
+auto AnyVisit( Any& any, VisitorT&& visitor )
+    -> decltype( visitor( any ) ) {
+    typedef typename std::remove_reference< VisitorT >::type V;
+    return AnyVisitTable< decltype( visitor( any ) ), Any, V, Ts... >::Visit( any, visitor );
+}
+
+/// Visit value contained in const @c Any instance, the visitor receives
+/// const references.
+template < class... Ts, class VisitorT >
+auto AnyVisit( const Any& any, VisitorT&& visitor )
+    -> decltype( visitor( any ) ) {
+    typedef typename std::remove_reference< VisitorT >::type V;
+    return AnyVisitTable< decltype( visitor( any ) ), const Any, V, Ts... >::Visit( any, visitor );
+}
+
+/// Visit all the values in range [@c first, @c last), visitor return values
+/// are discarded.
+template < class... Ts, class IteratorT, class VisitorT >
+void AnyVisit( IteratorT first, IteratorT last, VisitorT&& visitor ) {
+    for( ; first != last; ++first ) AnyVisit< Ts... >( *first, visitor );
+}
+
+/// Visit all the values in vector.
+template < class... Ts, class VisitorT >
+void AnyVisit( std::vector< Any >& v, VisitorT&& visitor ) {
+    AnyVisit< Ts... >( v.begin(), v.end(), visitor );
+}
+
+/// Visit all the values in const vector.
+template < class... Ts, class VisitorT >
+void AnyVisit( const std::vector< Any >& v, VisitorT&& visitor ) {
+    AnyVisit< Ts... >( v.begin(), v.end(), visitor );
+}
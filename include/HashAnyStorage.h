@@ -0,0 +1,172 @@
+#pragma once
+//Author: Ugo Varetto
+
+/// @file HashAnyStorage.h Hash table based storage.
+
+#include <vector>
+#include <typeinfo>
+#include <cstring>
+
+#include <AnyStorage.h>
+
+//------------------------------------------------------------------------------
+/// @brief Storage mapping keys to values through an open addressing hash
+/// table, drop-in replacement for MapAnyStorage when key ordering is not
+/// required; keys must support @c AnyHash and @c AnyEqual.
+/// Slots are organized in groups of eight with one control byte per slot:
+/// empty slots are marked with 0x80, used slots with the seven low order bits
+/// of the key's hash, so that a lookup examines the control bytes of a group
+/// in parallel and only compares the keys whose control byte matches.
+/// Groups are probed with a triangular sequence; the table grows by a factor
+/// of two when 7/8 of the slots are used.
+/// Keys of different types can be stored in the same instance.
+class HashAnyStorage : public IAnyStorage {
+public:
+    typedef Any Key;
+
+    HashAnyStorage() : size_( 0 ), growthLeft_( 0 ), groupMask_( 0 ) {}
+
+    virtual const Any& Get( const Any& key = Any() ) const {
+        const size_t i = Find( key, Hash( key ) );
+        return i != NPOS ? slots_[ i ].value : emptyAny_;
+    }
+    virtual Any Put( const Any& value, const Any& key = Any() ) {
+        return Put( Any( value ), key );
+    }
+    virtual Any Put( Any&& value, const Any& key = Any() ) {
+        const unsigned long long h = Hash( key );
+        size_t i = Find( key, h );
+        if( i == NPOS ) i = Insert( key, h );
+        slots_[ i ].value = std::move( value );
+        return key;
+    }
+    virtual HashAnyStorage* Clone() const {
+        HashAnyStorage* hs = new HashAnyStorage;
+        hs->ctrl_ = ctrl_;
+        hs->slots_ = slots_;
+        hs->size_ = size_;
+        hs->growthLeft_ = growthLeft_;
+        hs->groupMask_ = groupMask_;
+        return hs;
+    }
+    virtual const std::type_info& KeyType() const { return typeid( Key ); }
+    /// Visit elements in table order.
+    virtual void Visit( const Visitor& visitor ) const {
+        for( size_t i = 0; i != ctrl_.size(); ++i )
+            if( ctrl_[ i ] != EMPTY ) visitor( slots_[ i ].key, slots_[ i ].value );
+    }
+    /// Number of stored keys.
+    size_t Size() const { return size_; }
+private:
+    enum { GROUP_SIZE = 8 };
+    static const unsigned char EMPTY = 0x80;
+    static const size_t NPOS = size_t( -1 );
+    typedef unsigned long long Word;
+
+    struct Slot {
+        Any key;
+        Any value;
+    };
+
+    static unsigned long long Hash( const Any& key ) { return AnyMixedHash( key ); }
+    /// Seven bits stored in control byte.
+    static unsigned char H2( unsigned long long h ) {
+        return static_cast< unsigned char >( h & 0x7F );
+    }
+    /// Index of first group in probe sequence.
+    size_t H1( unsigned long long h ) const {
+        return static_cast< size_t >( h >> 7 ) & groupMask_;
+    }
+    /// Control bytes of group, byte i of group in byte i of result counting
+    /// from least significant.
+    Word LoadGroup( size_t g ) const {
+        Word w;
+        std::memcpy( &w, &ctrl_[ g * GROUP_SIZE ], sizeof( w ) );
+#if defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        w = __builtin_bswap64( w );
+#endif
+        return w;
+    }
+    /// Return mask with the high bit set in the bytes of the group which
+    /// may be equal to @c b; can report false positives, never false
+    /// negatives.
+    static Word MatchByte( Word w, unsigned char b ) {
+        const Word LSBS = 0x0101010101010101ULL;
+        const Word MSBS = 0x8080808080808080ULL;
+        const Word x = w ^ ( LSBS * b );
+        return ( x - LSBS ) & ~x & MSBS;
+    }
+    /// Return mask with the high bit set in the empty bytes of the group.
+    static Word MatchEmpty( Word w ) {
+        return w & 0x8080808080808080ULL;
+    }
+    /// Index in group of the lowest byte set in mask.
+    static size_t LowestByte( Word m ) {
+#if defined( __GNUC__ )
+        return size_t( __builtin_ctzll( m ) ) / 8;
+#else
+        size_t i = 0;
+        while( !( m & 0x80 ) ) { m >>= 8; ++i; }
+        return i;
+#endif
+    }
+    /// Return slot index of key, NPOS if not found.
+    size_t Find( const Any& key, unsigned long long h ) const {
+        if( ctrl_.empty() ) return NPOS;
+        const unsigned char h2 = H2( h );
+        size_t g = H1( h );
+        for( size_t step = 1; ; ++step ) {
+            const Word w = LoadGroup( g );
+            for( Word m = MatchByte( w, h2 ); m; m &= m - 1 ) {
+                const size_t i = g * GROUP_SIZE + LowestByte( m );
+                if( ctrl_[ i ] == h2 && AnyEquivalent( slots_[ i ].key, key ) )
+                    return i;
+            }
+            if( MatchEmpty( w ) ) return NPOS;
+            g = ( g + step ) & groupMask_;
+        }
+    }
+    /// Return index of first empty slot in probe sequence.
+    size_t FindEmpty( unsigned long long h ) const {
+        size_t g = H1( h );
+        for( size_t step = 1; ; ++step ) {
+            const Word m = MatchEmpty( LoadGroup( g ) );
+            if( m ) return g * GROUP_SIZE + LowestByte( m );
+            g = ( g + step ) & groupMask_;
+        }
+    }
+    /// Add key not in table and return its slot index.
+    size_t Insert( const Any& key, unsigned long long h ) {
+        if( growthLeft_ == 0 ) Rehash( ctrl_.empty() ? 1 : 2 * ( groupMask_ + 1 ) );
+        const size_t i = FindEmpty( h );
+        slots_[ i ].key = key;
+        ctrl_[ i ] = H2( h );
+        ++size_;
+        --growthLeft_;
+        return i;
+    }
+    /// Move all entries into a table with @c groups groups.
+    void Rehash( size_t groups ) {
+        std::vector< unsigned char > ctrl( groups * GROUP_SIZE, static_cast< unsigned char >( EMPTY ) );
+        std::vector< Slot > slots( groups * GROUP_SIZE );
+        ctrl.swap( ctrl_ );
+        slots.swap( slots_ );
+        groupMask_ = groups - 1;
+        for( size_t i = 0; i != ctrl.size(); ++i ) {
+            if( ctrl[ i ] == EMPTY ) continue;
+            const unsigned long long h = Hash( slots[ i ].key );
+            const size_t j = FindEmpty( h );
+            ctrl_[ j ] = H2( h );
+            slots_[ j ].key = std::move( slots[ i ].key );
+            slots_[ j ].value = std::move( slots[ i ].value );
+        }
+        growthLeft_ = ctrl_.size() - ctrl_.size() / 8 - size_;
+    }
+private:
+    std::vector< unsigned char > ctrl_;
+    std::vector< Slot > slots_;
+    size_t size_;
+    size_t growthLeft_;
+    size_t groupMask_;
+    Any emptyAny_;
+};
@@ -0,0 +1,663 @@
+#pragma once
+//Author: Ugo Varetto
+
+/// @file LogAnyStorage.h Persistent storage appending records to segment
+/// files.
+///
+/// Segments are files named <number>.log in the storage directory, each one
+/// a sequence of records: 32 bit CRC of the rest of the record, 32 bit key
+/// size, 32 bit value size, key, value; keys and values are encoded with
+/// AnyCodec.h. Records in higher numbered segments and at higher offsets
+/// replace previous records with the same key.
+/// Requires POSIX file I/O.
+
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <future>
+#include <exception>
+#include <boost/crc.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "AnyStorage.h"
+#include "AnyCodec.h"
+
+//------------------------------------------------------------------------------
+/// @brief Durable key-value storage: Put appends a record to the active
+/// segment and updates an in-memory index mapping keys to record locations;
+/// Get reads values through the index.
+/// Records are written by a dedicated thread, which takes all the records
+/// queued by concurrent Put and PutAsync calls and writes them with a single
+/// write and flush to disk per segment (group commit).
+/// When the active segment reaches the configured size a new one is started;
+/// sealed segments are merged by Compact(), which copies the records still
+/// referenced by the index into a new segment and deletes the old ones.
+/// Unless disabled at construction, compaction runs in a background thread
+/// whenever at least half of the bytes in sealed segments are stale.
+/// Keys must be non-empty and comparable with each other, i.e. of the same
+/// type; PutAsync throws @c std::logic_error for keys that are not, before
+/// queueing them.
+/// At construction the index is rebuilt by scanning all segments; a
+/// truncated or corrupted record at the end of the last segment, left by an
+/// interrupted write, is discarded, a corrupted record anywhere else causes
+/// a @c std::runtime_error to be thrown. Records with a valid checksum but
+/// a key that cannot be decoded or ordered with the other keys are skipped
+/// and counted, see SkippedRecords().
+/// All methods can be called concurrently; Get returns a reference to a
+/// value kept per thread and per instance, valid until the next call to Get
+/// on the same thread, on the same instance. The most recently read values
+/// are kept decoded, up to the number configured at construction; cached
+/// values are dropped when their key is overwritten and after compaction.
+class LogAnyStorage : public IAnyStorage {
+public:
+    typedef Any Key;
+    /// Size of record header: CRC, key size, value size.
+    enum { HEADER_SIZE = 3 * sizeof( unsigned int ) };
+    /// Open or create storage in directory @c dir.
+    /// @param segmentSize size after which a new segment is started
+    /// @param sync if @c true writes are flushed to disk before Put returns
+    ///        and PutAsync futures become ready, call Sync() otherwise
+    /// @param background run compaction in a background thread
+    /// @param cacheSize maximum number of decoded values cached by Get
+    explicit LogAnyStorage( const std::string& dir,
+                            std::size_t segmentSize = 1 << 26,
+                            bool sync = true,
+                            bool background = true,
+                            std::size_t cacheSize = 1024 )
+        : dir_( dir ), segmentSize_( segmentSize ), sync_( sync ),
+          active_( 0 ), version_( 0 ), cacheSize_( cacheSize ),
+          skipped_( 0 ), stop_( false ), closing_( false ) {
+        if( ::mkdir( dir.c_str(), 0777 ) != 0 && errno != EEXIST )
+            throw std::runtime_error( "Cannot create log directory: " + dir );
+        try {
+            Recover();
+            writer_ = boost::thread( &LogAnyStorage::WriteLoop, this );
+            if( background )
+                compactor_ = boost::thread( &LogAnyStorage::CompactionLoop, this );
+        } catch( ... ) {
+            Stop();
+            Close();
+            throw;
+        }
+    }
+    /// Write queued records and close segments.
+    ~LogAnyStorage() {
+        Stop();
+        Close();
+    }
+
+    virtual const Any& Get( const Any& key = Any() ) const {
+        Location l;
+        boost::shared_ptr< File > file;
+        ValuePtr value;
+        {
+            boost::lock_guard< boost::mutex > lock( mutex_ );
+            Index::const_iterator i = index_.find( key );
+            if( i == index_.end() ) return emptyAny_;
+            Values::iterator v = values_.find( key );
+            if( v != values_.end() ) {
+                lru_.splice( lru_.begin(), lru_, v->second.second );
+                value = v->second.first;
+            } else {
+                l = i->second;
+                file = segments_.find( l.segment )->second.file;
+            }
+        }
+        if( !value ) {
+            //the file stays open while read even if compaction removes segment
+            std::vector< char > buf;
+            ReadValue( file->fd, l, buf );
+            value.reset( new Any( AnyDecode( buf ) ) );
+            boost::lock_guard< boost::mutex > lock( mutex_ );
+            //not cached if overwritten or cached by other threads meanwhile
+            Index::const_iterator i = index_.find( key );
+            if( i != index_.end() && i->second.version == l.version ) Cache( key, value );
+        }
+        //the value stays alive while referenced even if evicted from cache
+        ValuePtr* p = value_.get();
+        if( !p ) value_.reset( p = new ValuePtr );
+        *p = value;
+        return **p;
+    }
+    /// Queue value for writing and wait until it is written.
+    virtual Any Put( const Any& value, const Any& key = Any() ) {
+        PutAsync( value, key ).get();
+        return key;
+    }
+    /// Queue value for writing and return immediately; the returned future
+    /// becomes ready once the value is written and visible to Get, or holds
+    /// the exception thrown by the write. Values are written in the order
+    /// they are queued. Throws @c std::logic_error if @c key cannot be
+    /// ordered with the stored keys.
+    std::future< void > PutAsync( const Any& value, const Any& key = Any() ) {
+        {
+            boost::lock_guard< boost::mutex > lock( mutex_ );
+            CheckKey( key );
+        }
+        Pending p;
+        p.key = key;
+        Encode( key, value, p.record );
+        return Enqueue( std::move( p ) );
+    }
+    /// Not supported: throws @c std::logic_error.
+    virtual LogAnyStorage* Clone() const {
+        throw std::logic_error( "LogAnyStorage cannot be cloned" );
+    }
+    virtual const std::type_info& KeyType() const { return typeid( Key ); }
+    /// Visit elements in key order, as found when Visit is called; the
+    /// visitor is called without holding locks and can access the storage.
+    virtual void Visit( const Visitor& visitor ) const {
+        std::vector< std::pair< Key, Location > > entries;
+        std::map< unsigned, boost::shared_ptr< File > > files;
+        {
+            boost::lock_guard< boost::mutex > lock( mutex_ );
+            entries.assign( index_.begin(), index_.end() );
+            for( SegmentMap::const_iterator i = segments_.begin(); i != segments_.end(); ++i )
+                files[ i->first ] = i->second.file;
+        }
+        std::vector< char > buf;
+        for( std::size_t i = 0; i != entries.size(); ++i ) {
+            ReadValue( files[ entries[ i ].second.segment ]->fd, entries[ i ].second, buf );
+            visitor( entries[ i ].first, AnyDecode( buf ) );
+        }
+    }
+    /// Number of stored elements.
+    std::size_t Size() const {
+        boost::lock_guard< boost::mutex > lock( mutex_ );
+        return index_.size();
+    }
+    /// Number of records skipped at construction because their key could
+    /// not be decoded or ordered with the other keys.
+    std::size_t SkippedRecords() const {
+        boost::lock_guard< boost::mutex > lock( mutex_ );
+        return skipped_;
+    }
+    /// Number of segment files.
+    std::size_t Segments() const {
+        boost::lock_guard< boost::mutex > lock( mutex_ );
+        return segments_.size();
+    }
+    /// Flush active segment to disk; sealed segments are flushed when
+    /// sealed.
+    void Sync() {
+        boost::lock_guard< boost::mutex > lock( mutex_ );
+        if( ::fdatasync( segments_[ active_ ].file->fd ) != 0 )
+            throw std::runtime_error( "Error syncing log segment" );
+    }
+    /// Start a new segment after writing queued records, sealing the active
+    /// one.
+    void Roll() {
+        Enqueue( Pending() ).get();
+    }
+    /// Merge all sealed segments into one containing only live records.
+    /// @return @c false if there are no sealed segments
+    bool Compact() {
+        boost::lock_guard< boost::mutex > cl( compactMutex_ );
+        std::vector< std::pair< Key, Location > > live;
+        std::vector< Location > copied;
+        std::vector< unsigned > sealed;
+        std::map< unsigned, boost::shared_ptr< File > > files;
+        {
+            boost::lock_guard< boost::mutex > lock( mutex_ );
+            for( SegmentMap::const_iterator i = segments_.begin(); i != segments_.end(); ++i )
+                if( i->first != active_ ) {
+                    sealed.push_back( i->first );
+                    files[ i->first ] = i->second.file;
+                }
+            if( sealed.empty() ) return false;
+            for( Index::const_iterator i = index_.begin(); i != index_.end(); ++i )
+                if( i->second.segment <= sealed.back() ) live.push_back( *i );
+        }
+        //sealed segments are only closed by compaction, no need to lock
+        //while copying
+        const unsigned last = sealed.back();
+        const std::string tmp = SegmentPath( last ) + ".tmp";
+        const int fd = ::open( tmp.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0666 );
+        if( fd < 0 ) throw std::runtime_error( "Cannot create log segment: " + tmp );
+        std::vector< char > record;
+        unsigned long long offset = 0;
+        try {
+            for( std::size_t i = 0; i != live.size(); ++i ) {
+                const Location& l = live[ i ].second;
+                record.resize( l.size );
+                Read( files[ l.segment ]->fd, l.offset, &record[ 0 ], l.size );
+                Write( fd, offset, record.data(), record.size() );
+                const Location n = { last, offset, l.keySize, l.size, l.version };
+                copied.push_back( n );
+                offset += l.size;
+            }
+            if( ::fsync( fd ) != 0 ) throw std::runtime_error( "Error syncing log segment" );
+        } catch( ... ) {
+            ::close( fd );
+            ::unlink( tmp.c_str() );
+            throw;
+        }
+        ::close( fd );
+        {
+            boost::lock_guard< boost::mutex > lock( mutex_ );
+            if( ::rename( tmp.c_str(), SegmentPath( last ).c_str() ) != 0 ) {
+                ::unlink( tmp.c_str() );
+                throw std::runtime_error( "Cannot rename log segment: " + tmp );
+            }
+            //files are closed when no longer read by Get
+            for( std::size_t i = 0; i != sealed.size(); ++i ) segments_.erase( sealed[ i ] );
+            Segment& s = segments_[ last ];
+            s.file = Open( last, O_RDONLY );
+            s.size = offset;
+            s.live = 0;
+            //records replaced while copying are stale
+            for( std::size_t i = 0; i != live.size(); ++i ) {
+                Location& l = index_[ live[ i ].first ];
+                if( l.segment == live[ i ].second.segment
+                    && l.offset == live[ i ].second.offset ) {
+                    l = copied[ i ];
+                    s.live += l.size;
+                }
+            }
+            values_.clear();
+            lru_.clear();
+        }
+        //make rename durable before removing the old segments; on crash
+        //before removal recovery reads the old records first and replaces
+        //them with the ones in the compacted segment
+        SyncDir();
+        for( std::size_t i = 0; i + 1 < sealed.size(); ++i )
+            ::unlink( SegmentPath( sealed[ i ] ).c_str() );
+        return true;
+    }
+private:
+    /// Location of record.
+    struct Location {
+        unsigned segment;
+        unsigned long long offset;
+        std::size_t keySize;
+        std::size_t size;
+        /// Number of the Put that wrote the record, preserved by compaction.
+        unsigned long long version;
+    };
+    /// Segment file descriptor, closed at destruction.
+    struct File : boost::noncopyable {
+        explicit File( int d ) : fd( d ) {}
+        ~File() { ::close( fd ); }
+        const int fd;
+    };
+    struct Segment {
+        boost::shared_ptr< File > file;
+        unsigned long long size;
+        /// Bytes of records referenced by the index.
+        unsigned long long live;
+    };
+    /// Queued record; an empty record requests a new segment.
+    struct Pending {
+        Key key;
+        std::vector< char > record;
+        std::promise< void > done;
+    };
+    typedef std::map< Key, Location > Index;
+    typedef std::map< unsigned, Segment > SegmentMap;
+    typedef boost::shared_ptr< const Any > ValuePtr;
+    /// Keys of cached values, most recently used first.
+    typedef std::list< Key > Lru;
+    typedef std::map< Key, std::pair< ValuePtr, Lru::iterator > > Values;
+
+    static void Encode( const Any& key, const Any& value, std::vector< char >& record ) {
+        record.resize( HEADER_SIZE );
+        AnyEncode( key, record );
+        const std::size_t keySize = record.size() - HEADER_SIZE;
+        AnyEncode( value, record );
+        const unsigned int sizes[] = { unsigned( keySize ),
+                                       unsigned( record.size() - HEADER_SIZE - keySize ) };
+        std::memcpy( &record[ sizeof( unsigned int ) ], sizes, sizeof( sizes ) );
+        boost::crc_32_type crc;
+        crc.process_bytes( &record[ sizeof( unsigned int ) ],
+                           record.size() - sizeof( unsigned int ) );
+        const unsigned int c = crc.checksum();
+        std::memcpy( &record[ 0 ], &c, sizeof( c ) );
+    }
+    std::future< void > Enqueue( Pending&& p ) {
+        std::future< void > f = p.done.get_future();
+        {
+            boost::lock_guard< boost::mutex > lock( queueMutex_ );
+            queue_.push_back( std::move( p ) );
+        }
+        queueCond_.notify_one();
+        return f;
+    }
+    void WriteLoop() {
+        std::vector< Pending > batch;
+        while( true ) {
+            {
+                boost::unique_lock< boost::mutex > lock( queueMutex_ );
+                while( queue_.empty() && !closing_ ) queueCond_.wait( lock );
+                if( queue_.empty() ) return;
+                batch.swap( queue_ );
+            }
+            Commit( batch );
+            batch.clear();
+        }
+    }
+    /// Write records with one write per segment, then update index and make
+    /// futures ready.
+    void Commit( std::vector< Pending >& batch ) {
+        std::vector< char > buf;
+        std::size_t first = 0;
+        try {
+            while( first != batch.size() ) {
+                unsigned segment;
+                int fd;
+                unsigned long long offset;
+                {
+                    boost::lock_guard< boost::mutex > lock( mutex_ );
+                    const Segment& s = segments_[ active_ ];
+                    if( s.size && ( batch[ first ].record.empty()
+                                    || s.size + batch[ first ].record.size() > segmentSize_ ) ) {
+                        NewSegment();
+                        cond_.notify_all();
+                    }
+                    if( batch[ first ].record.empty() ) {
+                        batch[ first++ ].done.set_value();
+                        continue;
+                    }
+                    segment = active_;
+                    fd = segments_[ active_ ].file->fd;
+                    offset = segments_[ active_ ].size;
+                }
+                //only this thread writes to and seals the active segment, no
+                //need to lock while writing
+                std::size_t last = first;
+                buf.clear();
+                while( last != batch.size() && !batch[ last ].record.empty()
+                       && ( last == first
+                            || offset + buf.size() + batch[ last ].record.size() <= segmentSize_ ) ) {
+                    buf.insert( buf.end(), batch[ last ].record.begin(), batch[ last ].record.end() );
+                    ++last;
+                }
+                try {
+                    Write( fd, offset, buf.data(), buf.size() );
+                    if( sync_ && ::fdatasync( fd ) != 0 )
+                        throw std::runtime_error( "Error syncing log segment" );
+                } catch( ... ) {
+                    //drop partial records
+                    if( ::ftruncate( fd, off_t( offset ) ) != 0 ) {}
+                    throw;
+                }
+                {
+                    boost::lock_guard< boost::mutex > lock( mutex_ );
+                    segments_[ segment ].size += buf.size();
+                    for( std::size_t i = first; i != last; ++i ) {
+                        unsigned int keySize;
+                        std::memcpy( &keySize, &batch[ i ].record[ sizeof( unsigned int ) ], sizeof( keySize ) );
+                        const Location l = { segment, offset, keySize, batch[ i ].record.size(), 0 };
+                        Update( batch[ i ].key, l );
+                        offset += l.size;
+                    }
+                }
+                for( ; first != last; ++first ) batch[ first ].done.set_value();
+            }
+        } catch( ... ) {
+            for( ; first != batch.size(); ++first )
+                batch[ first ].done.set_exception( std::current_exception() );
+        }
+    }
+    /// Throw @c std::logic_error if @c key is empty or cannot be compared
+    /// with the first key accepted, which then constrains all the keys
+    /// written to the same type; requires lock.
+    void CheckKey( const Key& key ) {
+        AnyCompare( key, key );
+        if( sampleKey_.Empty() ) sampleKey_ = key;
+        else AnyCompare( key, sampleKey_ );
+    }
+    /// Point key to new location of a new record, assigning it the next
+    /// version, and account for stale record; requires lock.
+    void Update( const Key& key, Location l ) {
+        l.version = ++version_;
+        std::pair< Index::iterator, bool > i = index_.insert( std::make_pair( key, l ) );
+        if( !i.second ) {
+            segments_[ i.first->second.segment ].live -= i.first->second.size;
+            i.first->second = l;
+            Values::iterator v = values_.find( key );
+            if( v != values_.end() ) {
+                lru_.erase( v->second.second );
+                values_.erase( v );
+            }
+        }
+        segments_[ l.segment ].live += l.size;
+    }
+    /// Add value read by Get to cache, evicting the least recently used one
+    /// if full; requires lock.
+    void Cache( const Key& key, const ValuePtr& value ) const {
+        if( cacheSize_ == 0 || values_.count( key ) ) return;
+        if( values_.size() == cacheSize_ ) {
+            values_.erase( lru_.back() );
+            lru_.pop_back();
+        }
+        lru_.push_front( key );
+        values_.insert( std::make_pair( key, std::make_pair( value, lru_.begin() ) ) );
+    }
+    /// Read value of record at @c l from file @c fd into @c buf.
+    static void ReadValue( int fd, const Location& l, std::vector< char >& buf ) {
+        buf.resize( l.size - HEADER_SIZE - l.keySize );
+        if( buf.empty() ) return;
+        Read( fd, l.offset + HEADER_SIZE + l.keySize, &buf[ 0 ], buf.size() );
+    }
+    static void Read( int fd, unsigned long long offset, char* p, std::size_t size ) {
+        while( size ) {
+            const ssize_t r = ::pread( fd, p, size, off_t( offset ) );
+            if( r < 0 && errno == EINTR ) continue;
+            if( r <= 0 ) throw std::runtime_error( "Error reading log segment" );
+            p += r;
+            offset += r;
+            size -= r;
+        }
+    }
+    static void Write( int fd, unsigned long long offset, const char* p, std::size_t size ) {
+        while( size ) {
+            const ssize_t r = ::pwrite( fd, p, size, off_t( offset ) );
+            if( r < 0 && errno == EINTR ) continue;
+            if( r <= 0 ) throw std::runtime_error( "Error writing log segment" );
+            p += r;
+            offset += r;
+            size -= r;
+        }
+    }
+    std::string SegmentPath( unsigned n ) const {
+        char name[ 32 ];
+        std::snprintf( name, sizeof( name ), "/%010u.log", n );
+        return dir_ + name;
+    }
+    boost::shared_ptr< File > Open( unsigned n, int flags ) const {
+        const std::string path = SegmentPath( n );
+        const int fd = ::open( path.c_str(), flags, 0666 );
+        if( fd < 0 ) throw std::runtime_error( "Cannot open log segment: " + path );
+        try {
+            return boost::make_shared< File >( fd );
+        } catch( ... ) {
+            ::close( fd );
+            throw;
+        }
+    }
+    /// Flush directory entries to disk, making created and renamed segment
+    /// files durable.
+    void SyncDir() const {
+        const int fd = ::open( dir_.c_str(), O_RDONLY | O_DIRECTORY );
+        if( fd < 0 ) throw std::runtime_error( "Cannot open log directory: " + dir_ );
+        const int r = ::fsync( fd );
+        ::close( fd );
+        if( r != 0 ) throw std::runtime_error( "Error syncing log directory: " + dir_ );
+    }
+    /// Seal active segment and create a new one; requires lock.
+    void NewSegment() {
+        //only the last segment can be truncated at recovery
+        if( !sync_ && ::fdatasync( segments_[ active_ ].file->fd ) != 0 )
+            throw std::runtime_error( "Error syncing log segment" );
+        const Segment s = { Open( active_ + 1, O_CREAT | O_TRUNC | O_RDWR ), 0, 0 };
+        segments_[ ++active_ ] = s;
+        SyncDir();
+    }
+    /// Rebuild index from segment files.
+    void Recover() {
+        std::vector< unsigned > numbers;
+        DIR* d = ::opendir( dir_.c_str() );
+        if( !d ) throw std::runtime_error( "Cannot read log directory: " + dir_ );
+        while( const dirent* e = ::readdir( d ) ) {
+            const std::string name = e->d_name;
+            const std::size_t dot = name.find( '.' );
+            if( dot == 0 || dot == std::string::npos
+                || name.find_first_not_of( "0123456789" ) != dot ) continue;
+            const unsigned n = unsigned( std::strtoul( name.c_str(), 0, 10 ) );
+            if( name.substr( dot ) == ".log" ) numbers.push_back( n );
+            //interrupted compaction
+            else if( name.substr( dot ) == ".log.tmp" ) ::unlink( SegmentPath( n ).append( ".tmp" ).c_str() );
+        }
+        ::closedir( d );
+        std::sort( numbers.begin(), numbers.end() );
+        std::vector< char > buf;
+        for( std::size_t i = 0; i != numbers.size(); ++i ) {
+            const bool last = i + 1 == numbers.size();
+            Segment s = { Open( numbers[ i ], last ? O_RDWR : O_RDONLY ), 0, 0 };
+            segments_[ numbers[ i ] ] = s;
+            struct stat st;
+            if( ::fstat( s.file->fd, &st ) != 0 )
+                throw std::runtime_error( "Cannot read log segment: " + SegmentPath( numbers[ i ] ) );
+            buf.resize( std::size_t( st.st_size ) );
+            if( !buf.empty() ) Read( s.file->fd, 0, &buf[ 0 ], buf.size() );
+            const unsigned long long valid = Scan( numbers[ i ], buf );
+            if( valid != buf.size() ) {
+                if( !last )
+                    throw std::runtime_error( "Corrupted log segment: " + SegmentPath( numbers[ i ] ) );
+                if( ::ftruncate( s.file->fd, off_t( valid ) ) != 0 || ::fsync( s.file->fd ) != 0 )
+                    throw std::runtime_error( "Cannot truncate log segment: " + SegmentPath( numbers[ i ] ) );
+            }
+            segments_[ numbers[ i ] ].size = valid;
+        }
+        if( numbers.empty() ) {
+            const Segment s = { Open( 0, O_CREAT | O_TRUNC | O_RDWR ), 0, 0 };
+            segments_[ 0 ] = s;
+            SyncDir();
+        } else active_ = numbers.back();
+    }
+    /// Add valid records in segment to index, return size of valid prefix;
+    /// records with keys rejected by CheckKey are left stale.
+    unsigned long long Scan( unsigned n, const std::vector< char >& buf ) {
+        const char* begin = buf.data();
+        const char* end = begin + buf.size();
+        const char* p = begin;
+        while( std::size_t( end - p ) >= HEADER_SIZE ) {
+            unsigned int h[ 3 ];
+            std::memcpy( h, p, sizeof( h ) );
+            if( std::size_t( end - p ) - HEADER_SIZE < std::size_t( h[ 1 ] ) + h[ 2 ] ) break;
+            boost::crc_32_type crc;
+            crc.process_bytes( p + sizeof( unsigned int ),
+                               HEADER_SIZE - sizeof( unsigned int ) + h[ 1 ] + h[ 2 ] );
+            if( crc.checksum() != h[ 0 ] ) break;
+            const char* k = p + HEADER_SIZE;
+            const Location l = { n, static_cast< unsigned long long >( p - begin ), h[ 1 ],
+                                 HEADER_SIZE + std::size_t( h[ 1 ] ) + h[ 2 ], 0 };
+            try {
+                const Key key = AnyDecode( k, k + h[ 1 ] );
+                CheckKey( key );
+                Update( key, l );
+            } catch( const std::logic_error& ) {
+                ++skipped_;
+            } catch( const std::runtime_error& ) {
+                ++skipped_;
+            }
+            p += l.size;
+        }
+        return p - begin;
+    }
+    /// @c true if at least half of the bytes in sealed segments are stale;
+    /// requires lock.
+    bool NeedsCompaction() const {
+        unsigned long long size = 0, live = 0;
+        for( SegmentMap::const_iterator i = segments_.begin(); i != segments_.end(); ++i ) {
+            if( i->first == active_ ) continue;
+            size += i->second.size;
+            live += i->second.live;
+        }
+        return size && 2 * live <= size;
+    }
+    void CompactionLoop() {
+        boost::unique_lock< boost::mutex > lock( mutex_ );
+        while( true ) {
+            while( !stop_ && !NeedsCompaction() ) cond_.wait( lock );
+            if( stop_ ) return;
+            lock.unlock();
+            bool done = false;
+            try {
+                done = Compact();
+            } catch( const std::exception& ) {
+            }
+            lock.lock();
+            //retry after next segment is sealed
+            if( !done && !stop_ ) cond_.wait( lock );
+        }
+    }
+    /// Stop writer after writing queued records, then stop compaction.
+    void Stop() {
+        if( writer_.joinable() ) {
+            {
+                boost::lock_guard< boost::mutex > lock( queueMutex_ );
+                closing_ = true;
+            }
+            queueCond_.notify_all();
+            writer_.join();
+        }
+        if( compactor_.joinable() ) {
+            {
+                boost::lock_guard< boost::mutex > lock( mutex_ );
+                stop_ = true;
+            }
+            cond_.notify_all();
+            compactor_.join();
+        }
+    }
+    void Close() {
+        segments_.clear();
+    }
+private:
+    std::string dir_;
+    std::size_t segmentSize_;
+    bool sync_;
+    unsigned active_;
+    Index index_;
+    /// Version of last record written.
+    unsigned long long version_;
+    std::size_t cacheSize_;
+    mutable Values values_;
+    mutable Lru lru_;
+    /// Last value returned to calling thread.
+    mutable boost::thread_specific_ptr< ValuePtr > value_;
+    Any emptyAny_;
+    /// First key accepted, see CheckKey.
+    Key sampleKey_;
+    std::size_t skipped_;
+    SegmentMap segments_;
+    mutable boost::mutex mutex_;
+    boost::mutex compactMutex_;
+    boost::condition_variable cond_;
+    bool stop_;
+    boost::thread compactor_;
+    std::vector< Pending > queue_;
+    boost::mutex queueMutex_;
+    boost::condition_variable queueCond_;
+    bool closing_;
+    boost::thread writer_;
+};
@@ -0,0 +1,360 @@
+#pragma once
+//Author: Ugo Varetto
+
+/// @file SSTableAnyStorage.h Read-only storage backed by an immutable sorted
+/// table file.
+///
+/// File layout, all offsets relative to the beginning of the file:
+///  - data blocks, each one containing
+///    - entries: 32 bit length of key prefix shared with previous entry,
+///      32 bit length of remaining key bytes, 32 bit value size, remaining
+///      key bytes, value
+///    - 32 bit offsets of restart entries, which share no prefix, followed
+///      by the 32 bit number of restart entries
+///  - index: per block 64 bit offset, 32 bit size, 32 bit last key size,
+///    last key
+///  - footer: 64 bit index offset, 64 bit index size, 64 bit number of
+///    entries, 8 byte magic
+/// Keys and values are encoded with AnyCodec.h, keys are sorted according to
+/// AnyCompare.
+
+#include <cstring>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <list>
+#include <utility>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "AnyStorage.h"
+#include "AnyCodec.h"
+#include "AnyView.h"
+
+//------------------------------------------------------------------------------
+/// @brief Read-only storage mapping a sorted table file built from another
+/// storage with Build(): only one key per block is kept in memory, entries
+/// are found through binary search of the block index, then of the restart
+/// entries of the block, then by scanning at most @c RESTART_INTERVAL
+/// prefix compressed keys.
+/// Optionally the decoded content of recently used blocks is cached.
+/// Get can be called concurrently; the value found is decoded into a copy
+/// kept per thread and per instance, the reference returned is valid until
+/// the next call to Get on the same thread, on the same instance.
+/// Copies are released when threads exit.
+/// Put throws @c std::logic_error.
+class SSTableAnyStorage : public IAnyStorage {
+public:
+    typedef Any Key;
+    enum { RESTART_INTERVAL = 16 };
+
+    /// Write sorted table with the content of @c src, which must support
+    /// Visit; keys and values must be of types registered with the codec
+    /// (see AnyCodec.h) and keys must be comparable with each other.
+    static void Build( const std::string& path, const IAnyStorage& src,
+                       std::size_t blockSize = 4096 ) {
+        std::vector< std::pair< Any, Any > > entries;
+        src.Visit( [ &entries ]( const Any& k, const Any& v ) {
+            entries.push_back( std::make_pair( k, v ) );
+        } );
+        std::sort( entries.begin(), entries.end(), []( const std::pair< Any, Any >& e1,
+                                                       const std::pair< Any, Any >& e2 ) {
+            return AnyCompare( e1.first, e2.first ) < 0;
+        } );
+        std::ofstream os( path.c_str(), std::ios::binary | std::ios::trunc );
+        if( !os ) throw std::runtime_error( "Cannot create sorted table: " + path );
+        std::vector< char > block, index, key, prev, value;
+        std::vector< unsigned int > restarts;
+        unsigned long long offset = 0;
+        std::size_t n = 0;
+        for( std::size_t i = 0; i != entries.size(); ++i ) {
+            key.clear();
+            value.clear();
+            AnyEncode( entries[ i ].first, key );
+            AnyEncode( entries[ i ].second, value );
+            std::size_t shared = 0;
+            if( n % RESTART_INTERVAL == 0 ) restarts.push_back( unsigned( block.size() ) );
+            else while( shared < std::min( key.size(), prev.size() ) && key[ shared ] == prev[ shared ] ) ++shared;
+            AnyCodecWriteSize( block, shared );
+            AnyCodecWriteSize( block, key.size() - shared );
+            AnyCodecWriteSize( block, value.size() );
+            AnyCodecWrite( block, key.data() + shared, key.size() - shared );
+            AnyCodecWrite( block, value.data(), value.size() );
+            prev.swap( key );
+            ++n;
+            if( block.size() >= blockSize || i + 1 == entries.size() ) {
+                for( std::size_t r = 0; r != restarts.size(); ++r ) AnyCodecWriteSize( block, restarts[ r ] );
+                AnyCodecWriteSize( block, restarts.size() );
+                os.write( block.data(), std::streamsize( block.size() ) );
+                AnyCodecWrite( index, &offset, sizeof( offset ) );
+                AnyCodecWriteSize( index, block.size() );
+                AnyCodecWriteSize( index, prev.size() );
+                AnyCodecWrite( index, prev.data(), prev.size() );
+                offset += block.size();
+                block.clear();
+                restarts.clear();
+                n = 0;
+            }
+        }
+        os.write( index.data(), std::streamsize( index.size() ) );
+        const unsigned long long footer[] = { offset, index.size(), entries.size() };
+        os.write( reinterpret_cast< const char* >( footer ), sizeof( footer ) );
+        os.write( MAGIC, 8 );
+        os.close();
+        if( !os ) throw std::runtime_error( "Error writing sorted table: " + path );
+    }
+    /// Map sorted table file, caching the decoded content of up to
+    /// @c cachedBlocks blocks.
+    static SSTableAnyStorage* Open( const std::string& path, std::size_t cachedBlocks = 0 ) {
+        SSTableAnyStorage* ss = new SSTableAnyStorage;
+        try {
+            ss->table_ = new Table( path );
+            ss->cache_.reset( new Cache( cachedBlocks ) );
+        } catch( ... ) {
+            delete ss;
+            throw;
+        }
+        return ss;
+    }
+
+    virtual const Any& Get( const Any& key = Any() ) const {
+        const std::vector< char > kb = AnyEncode( key );
+        const AnyView k( kb );
+        const std::size_t b = table_->FindBlock( k );
+        if( b == table_->Blocks() ) return emptyAny_;
+        Any result;
+        if( cache_->Capacity() ) {
+            boost::shared_ptr< const DecodedBlock > d = cache_->Get( b );
+            if( !d ) d = cache_->Put( b, table_->Decode( b ) );
+            DecodedBlock::const_iterator i =
+                std::lower_bound( d->begin(), d->end(), key,
+                                  []( const std::pair< Any, Any >& e, const Any& k ) {
+                                      return AnyCompare( e.first, k ) < 0;
+                                  } );
+            if( i != d->end() && AnyCompare( i->first, key ) == 0 ) result = i->second;
+        } else table_->Find( b, k, result );
+        if( result.Empty() ) return emptyAny_;
+        Any* v = value_.get();
+        if( !v ) value_.reset( v = new Any );
+        *v = std::move( result );
+        return *v;
+    }
+    virtual Any Put( const Any&, const Any& = Any() ) {
+        throw std::logic_error( "SSTableAnyStorage is read-only" );
+    }
+    virtual Any Put( Any&&, const Any& = Any() ) {
+        throw std::logic_error( "SSTableAnyStorage is read-only" );
+    }
+    /// Share table and cache configuration with new instance.
+    virtual SSTableAnyStorage* Clone() const {
+        SSTableAnyStorage* ss = new SSTableAnyStorage;
+        ss->table_ = table_;
+        ss->cache_.reset( new Cache( cache_->Capacity() ) );
+        return ss;
+    }
+    virtual const std::type_info& KeyType() const { return typeid( Key ); }
+    /// Visit elements in key order.
+    virtual void Visit( const Visitor& visitor ) const {
+        for( std::size_t b = 0; b != table_->Blocks(); ++b ) {
+            const DecodedBlock d = table_->Decode( b );
+            for( DecodedBlock::const_iterator i = d.begin(); i != d.end(); ++i )
+                visitor( i->first, i->second );
+        }
+    }
+    /// Number of stored elements.
+    std::size_t Size() const { return table_->Size(); }
+private:
+    static constexpr const char* MAGIC = "ANYSSTB1";
+    typedef std::vector< std::pair< Any, Any > > DecodedBlock;
+
+    /// Mapped table file and block index.
+    class Table : public Referenced {
+    public:
+        explicit Table( const std::string& path )
+            : file_( path.c_str(), boost::interprocess::read_only ),
+              region_( file_, boost::interprocess::read_only )
+        {
+            const char* begin = static_cast< const char* >( region_.get_address() );
+            const char* end = begin + region_.get_size();
+            const std::size_t FOOTER = 3 * sizeof( unsigned long long ) + 8;
+            if( region_.get_size() < FOOTER || std::memcmp( end - 8, MAGIC, 8 ) != 0 )
+                throw std::runtime_error( "Invalid sorted table: " + path );
+            unsigned long long footer[ 3 ];
+            std::memcpy( footer, end - FOOTER, sizeof( footer ) );
+            if( footer[ 0 ] > region_.get_size() - FOOTER
+                || footer[ 1 ] > region_.get_size() - FOOTER - footer[ 0 ] )
+                throw std::runtime_error( "Invalid sorted table: " + path );
+            size_ = std::size_t( footer[ 2 ] );
+            const char* p = begin + footer[ 0 ];
+            const char* ie = p + footer[ 1 ];
+            while( p != ie ) {
+                unsigned long long offset;
+                AnyCodecRead( p, ie, &offset, sizeof( offset ) );
+                const std::size_t size = AnyCodecReadSize( p, ie );
+                const std::size_t keySize = AnyCodecReadSize( p, ie );
+                if( offset > footer[ 0 ] || size > footer[ 0 ] - offset
+                    || std::size_t( ie - p ) < keySize || size < sizeof( unsigned int ) )
+                    throw std::runtime_error( "Invalid sorted table: " + path );
+                const BlockInfo bi = { begin + offset, size, AnyView( p, p + keySize ) };
+                index_.push_back( bi );
+                p += keySize;
+            }
+        }
+        std::size_t Blocks() const { return index_.size(); }
+        std::size_t Size() const { return size_; }
+        /// Return index of first block with last key not less than @c k,
+        /// number of blocks if none.
+        std::size_t FindBlock( const AnyView& k ) const {
+            std::size_t lo = 0, hi = index_.size();
+            while( lo < hi ) {
+                const std::size_t mid = lo + ( hi - lo ) / 2;
+                if( AnyCompare( index_[ mid ].lastKey, k ) < 0 ) lo = mid + 1;
+                else hi = mid;
+            }
+            return lo;
+        }
+        /// Search key in block and decode value into @c result if found.
+        void Find( std::size_t b, const AnyView& k, Any& result ) const {
+            const BlockInfo& bi = index_[ b ];
+            const char* end = bi.data + bi.size - sizeof( unsigned int );
+            const char* p = end;
+            const std::size_t nr = AnyCodecReadSize( p, bi.data + bi.size );
+            if( nr == 0 || std::size_t( end - bi.data ) / sizeof( unsigned int ) < nr )
+                throw std::runtime_error( "Invalid sorted table block" );
+            const char* restarts = end - nr * sizeof( unsigned int );
+            //last restart with key not greater than k
+            std::size_t lo = 0, hi = nr - 1;
+            std::vector< char > key;
+            while( lo < hi ) {
+                const std::size_t mid = ( lo + hi + 1 ) / 2;
+                const char* e = Restart( bi.data, restarts, mid );
+                Entry( e, restarts, key );
+                if( AnyCompare( AnyView( key.data(), key.data() + key.size() ), k ) <= 0 ) lo = mid;
+                else hi = mid - 1;
+            }
+            const char* e = Restart( bi.data, restarts, lo );
+            key.clear();
+            while( e < restarts ) {
+                const char* value;
+                std::size_t valueSize;
+                e = Entry( e, restarts, key, &value, &valueSize );
+                const int r = AnyCompare( AnyView( key.data(), key.data() + key.size() ), k );
+                if( r > 0 ) return;
+                if( r == 0 ) {
+                    const char* v = value;
+                    result = AnyDecode( v, value + valueSize );
+                    return;
+                }
+            }
+        }
+        /// Decode all the entries of block @c b.
+        DecodedBlock Decode( std::size_t b ) const {
+            const BlockInfo& bi = index_[ b ];
+            const char* end = bi.data + bi.size - sizeof( unsigned int );
+            const char* p = end;
+            const std::size_t nr = AnyCodecReadSize( p, bi.data + bi.size );
+            if( nr == 0 || std::size_t( end - bi.data ) / sizeof( unsigned int ) < nr )
+                throw std::runtime_error( "Invalid sorted table block" );
+            const char* restarts = end - nr * sizeof( unsigned int );
+            DecodedBlock d;
+            std::vector< char > key;
+            for( const char* e = bi.data; e < restarts; ) {
+                const char* value;
+                std::size_t valueSize;
+                e = Entry( e, restarts, key, &value, &valueSize );
+                const char* k = key.data();
+                const char* v = value;
+                Any dk = AnyDecode( k, k + key.size() );
+                Any dv = AnyDecode( v, value + valueSize );
+                d.push_back( std::make_pair( std::move( dk ), std::move( dv.Share() ) ) );
+            }
+            return d;
+        }
+    private:
+        struct BlockInfo {
+            const char* data;
+            std::size_t size;
+            AnyView lastKey;
+        };
+        /// Return address of restart entry @c i of block starting at @c data.
+        static const char* Restart( const char* data, const char* restarts, std::size_t i ) {
+            unsigned int r;
+            std::memcpy( &r, restarts + i * sizeof( r ), sizeof( r ) );
+            if( r >= std::size_t( restarts - data ) )
+                throw std::runtime_error( "Invalid sorted table block" );
+            return data + r;
+        }
+        /// Read entry at @c e, update @c key with its key and return address
+        /// of next entry.
+        static const char* Entry( const char* e, const char* end, std::vector< char >& key,
+                                  const char** value = 0, std::size_t* valueSize = 0 ) {
+            const std::size_t shared = AnyCodecReadSize( e, end );
+            const std::size_t unshared = AnyCodecReadSize( e, end );
+            const std::size_t vs = AnyCodecReadSize( e, end );
+            if( shared > key.size() || std::size_t( end - e ) < unshared
+                || std::size_t( end - e ) - unshared < vs )
+                throw std::runtime_error( "Invalid sorted table block" );
+            key.resize( shared );
+            key.insert( key.end(), e, e + unshared );
+            e += unshared;
+            if( value ) *value = e;
+            if( valueSize ) *valueSize = vs;
+            return e + vs;
+        }
+    private:
+        boost::interprocess::file_mapping file_;
+        boost::interprocess::mapped_region region_;
+        std::vector< BlockInfo > index_;
+        std::size_t size_;
+    };
+
+    /// Least recently used decoded blocks.
+    class Cache {
+    public:
+        explicit Cache( std::size_t capacity ) : capacity_( capacity ) {}
+        std::size_t Capacity() const { return capacity_; }
+        boost::shared_ptr< const DecodedBlock > Get( std::size_t b ) {
+            boost::lock_guard< boost::mutex > lock( mutex_ );
+            Map::iterator i = blocks_.find( b );
+            if( i == blocks_.end() ) return boost::shared_ptr< const DecodedBlock >();
+            lru_.splice( lru_.begin(), lru_, i->second.second );
+            return i->second.first;
+        }
+        boost::shared_ptr< const DecodedBlock > Put( std::size_t b, DecodedBlock d ) {
+            boost::shared_ptr< const DecodedBlock > p( new DecodedBlock( std::move( d ) ) );
+            boost::lock_guard< boost::mutex > lock( mutex_ );
+            if( blocks_.count( b ) ) return blocks_[ b ].first;
+            if( blocks_.size() == capacity_ ) {
+                blocks_.erase( lru_.back() );
+                lru_.pop_back();
+            }
+            lru_.push_front( b );
+            blocks_[ b ] = std::make_pair( p, lru_.begin() );
+            return p;
+        }
+    private:
+        typedef std::unordered_map< std::size_t, std::pair<
+                    boost::shared_ptr< const DecodedBlock >,
+                    std::list< std::size_t >::iterator > > Map;
+        std::size_t capacity_;
+        boost::mutex mutex_;
+        std::list< std::size_t > lru_;
+        Map blocks_;
+    };
+private:
+    SSTableAnyStorage() {}
+    boost::intrusive_ptr< Table > table_;
+    boost::scoped_ptr< Cache > cache_;
+    /// Last value returned to calling thread.
+    mutable boost::thread_specific_ptr< Any > value_;
+    Any emptyAny_;
+};
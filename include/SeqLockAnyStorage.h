@@ -0,0 +1,163 @@
+#pragma once
+//Author: Ugo Varetto
+
+/// @file SeqLockAnyStorage.h Single value storage for values written rarely
+/// and read concurrently very often.
+
+#include <cstring>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include "AnyStorage.h"
+
+//------------------------------------------------------------------------------
+/// @brief Single value storage where readers do not write to memory shared
+/// with other threads, suitable for publishing values written rarely and
+/// read very often; writes are serialized and increment a sequence number.
+/// Values of trivially copyable types not larger than @c PAYLOAD_SIZE bytes
+/// are also copied to words protected by the sequence number (seqlock):
+/// Read<T>() copies them and retries if a write happened meanwhile.
+/// Get() returns a copy of the value kept per thread and per instance,
+/// updated under lock only when the sequence number has changed since the
+/// last copy; the reference is valid until the next call to Put, or to Get
+/// on the same thread, on the same instance.
+/// Copies are released when their thread exits or the instance is
+/// destroyed.
+class SeqLockAnyStorage : public IAnyStorage {
+public:
+    enum { PAYLOAD_SIZE = 64 };
+
+    SeqLockAnyStorage() : seq_( 0 ), type_( 0 ), id_( NextId() ) {
+        for( int i = 0; i != PAYLOAD_WORDS; ++i ) payload_[ i ].store( 0, boost::memory_order_relaxed );
+    }
+    /// Release per thread copies of the value.
+    ~SeqLockAnyStorage() {
+        for( std::size_t i = 0; i != entries_.size(); ++i )
+            if( EntryPtr e = entries_[ i ].lock() ) e->value = Any();
+    }
+    virtual const Any& Get( const Any& = Any() ) const {
+        CacheEntry& e = Entry();
+        if( e.version == seq_.load( boost::memory_order_acquire ) ) return e.value;
+        boost::lock_guard< boost::mutex > lock( mutex_ );
+        e.value = value_;
+        e.version = seq_.load( boost::memory_order_relaxed );
+        return e.value;
+    }
+    virtual Any Put( const Any& value, const Any& key = Any() ) {
+        return Put( Any( value ), key );
+    }
+    virtual Any Put( Any&& value, const Any& = Any() ) {
+        boost::lock_guard< boost::mutex > lock( mutex_ );
+        const Word s = seq_.load( boost::memory_order_relaxed );
+        //odd while writing
+        seq_.store( s + 1, boost::memory_order_relaxed );
+        boost::atomic_thread_fence( boost::memory_order_release );
+        if( AnyIsTriviallyCopyable( value ) && AnySizeOf( value ) <= PAYLOAD_SIZE ) {
+            Word w[ PAYLOAD_WORDS ] = {};
+            std::memcpy( w, AnyAddress( static_cast< const Any& >( value ) ), AnySizeOf( value ) );
+            for( int i = 0; i != PAYLOAD_WORDS; ++i ) payload_[ i ].store( w[ i ], boost::memory_order_relaxed );
+            type_.store( value.TypeId(), boost::memory_order_relaxed );
+        } else type_.store( 0, boost::memory_order_relaxed );
+        value_ = std::move( value );
+        seq_.store( s + 2, boost::memory_order_release );
+        return Any();
+    }
+    /// Return copy of value of trivially copyable type @c T without locking,
+    /// retrying while a write is in progress; if the value is not of type
+    /// @c T or is too large the value returned by Get is converted with
+    /// AnyRef, which throws on type mismatch.
+    template < class T > T Read() const {
+        static_assert( std::is_trivially_copyable< T >::value,
+                       "SeqLockAnyStorage::Read requires trivially copyable type" );
+        enum { WORDS = ( sizeof( T ) + sizeof( Word ) - 1 ) / sizeof( Word ) };
+        if( sizeof( T ) <= PAYLOAD_SIZE ) {
+            Word w[ WORDS ];
+            for( ;; ) {
+                const Word s = seq_.load( boost::memory_order_acquire );
+                if( s & 1 ) {
+                    boost::this_thread::yield();
+                    continue;
+                }
+                const AnyTypeId t = type_.load( boost::memory_order_relaxed );
+                for( int i = 0; i != WORDS && i != PAYLOAD_WORDS; ++i )
+                    w[ i ] = payload_[ i ].load( boost::memory_order_relaxed );
+                boost::atomic_thread_fence( boost::memory_order_acquire );
+                if( seq_.load( boost::memory_order_relaxed ) != s ) continue;
+                if( t != AnyTypeIdOf< T >() ) break;
+                typename std::aligned_storage< sizeof( T ), std::alignment_of< T >::value >::type v;
+                std::memcpy( &v, w, sizeof( T ) );
+                return reinterpret_cast< const T& >( v );
+            }
+        }
+        return AnyRef< T >( Get() );
+    }
+    /// Number of writes.
+    unsigned long long Version() const {
+        return seq_.load( boost::memory_order_acquire ) / 2;
+    }
+    virtual SeqLockAnyStorage* Clone() const {
+        SeqLockAnyStorage* sp = new SeqLockAnyStorage;
+        boost::lock_guard< boost::mutex > lock( mutex_ );
+        if( !value_.Empty() ) sp->Put( value_ );
+        return sp;
+    }
+    virtual const std::type_info& KeyType() const { return typeid( Any ); }
+    virtual void Visit( const Visitor& visitor ) const {
+        const Any& v = Get();
+        if( !v.Empty() ) visitor( Any(), v );
+    }
+private:
+    typedef unsigned long long Word;
+    enum { PAYLOAD_WORDS = PAYLOAD_SIZE / sizeof( Word ) };
+    /// Per thread copy of value; odd version until first copied.
+    struct CacheEntry {
+        explicit CacheEntry( unsigned long long i ) : id( i ), version( 1 ) {}
+        const unsigned long long id;
+        Word version;
+        Any value;
+    };
+    typedef boost::shared_ptr< CacheEntry > EntryPtr;
+    typedef boost::weak_ptr< CacheEntry > WeakEntryPtr;
+    /// Return copy for calling thread, registering a new one on first call.
+    CacheEntry& Entry() const {
+        EntryPtr* p = cache_.get();
+        //entries left by destroyed instances at the same address have
+        //different identifiers
+        if( p && ( *p )->id == id_ ) return **p;
+        EntryPtr e( new CacheEntry( id_ ) );
+        {
+            boost::lock_guard< boost::mutex > lock( mutex_ );
+            //drop entries of exited threads
+            entries_.erase( std::remove_if( entries_.begin(), entries_.end(),
+                                            []( const WeakEntryPtr& w ) { return w.expired(); } ),
+                            entries_.end() );
+            entries_.push_back( e );
+        }
+        if( p ) *p = e;
+        else cache_.reset( new EntryPtr( e ) );
+        return *e;
+    }
+    /// Unique instance identifier, not reused when instances are destroyed.
+    static unsigned long long NextId() {
+        static boost::atomic< unsigned long long > next( 1 );
+        return next.fetch_add( 1, boost::memory_order_relaxed );
+    }
+private:
+    boost::atomic< Word > seq_;
+    boost::atomic< AnyTypeId > type_;
+    boost::atomic< Word > payload_[ PAYLOAD_WORDS ];
+    const unsigned long long id_;
+    mutable boost::mutex mutex_;
+    Any value_;
+    /// Copy of calling thread, deleted when the thread exits.
+    mutable boost::thread_specific_ptr< EntryPtr > cache_;
+    /// Copies of the threads calling Get.
+    mutable std::vector< WeakEntryPtr > entries_;
+};
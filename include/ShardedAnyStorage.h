@@ -0,0 +1,122 @@
+#pragma once
+//Author: Ugo Varetto
+
+/// @file ShardedAnyStorage.h Storage partitioned into independently locked
+/// shards.
+
+#include <cstddef>
+#include <stdexcept>
+#include <typeinfo>
+#include <vector>
+#include <utility>
+#include <boost/thread.hpp>
+
+#include "AnyStorage.h"
+
+//------------------------------------------------------------------------------
+/// @brief Synchronized storage distributing keys among @c N storages of type
+/// @c AnyStorageT according to their hash, each one protected by its own
+/// mutex of type @c MutexT (Lockable) placed on its own cache line, so that
+/// accesses to keys in different shards do not contend.
+/// Keys must not be empty: Put with an empty key throws
+/// @c std::logic_error.
+/// Clone and Size lock all the shards in increasing order and return a
+/// consistent state of the storage; Visit copies the elements of one shard
+/// at a time under its lock, then passes them to the visitor without
+/// holding locks, in no particular key order, so the visitor can access the
+/// storage.
+template < typename AnyStorageT, std::size_t N = 16, typename MutexT = boost::mutex >
+class ShardedAnyStorage : public IAnyStorage {
+public:
+    typedef AnyStorageT StorageType;
+    typedef MutexT MutexType;
+    typedef ShardedAnyStorage< AnyStorageT, N, MutexT > ThisType;
+    typedef Any Key;
+    enum { SHARDS = N, CACHE_LINE_SIZE = 64 };
+
+    ShardedAnyStorage() {
+        for( std::size_t i = 0; i != N; ++i ) shards_[ i ].storage = new StorageType;
+    }
+    virtual const Any& Get( const Any& key = Any() ) const {
+        const Shard& s = shards_[ ShardOf( key ) ];
+        boost::lock_guard< MutexType > lock( s.mutex );
+        return s.storage->Get( key );
+    }
+    virtual Any Put( const Any& value, const Any& key = Any() ) {
+        if( key.Empty() ) throw std::logic_error( "ShardedAnyStorage: empty key" );
+        Shard& s = shards_[ ShardOf( key ) ];
+        boost::lock_guard< MutexType > lock( s.mutex );
+        return s.storage->Put( value, key );
+    }
+    virtual Any Put( Any&& value, const Any& key = Any() ) {
+        if( key.Empty() ) throw std::logic_error( "ShardedAnyStorage: empty key" );
+        Shard& s = shards_[ ShardOf( key ) ];
+        boost::lock_guard< MutexType > lock( s.mutex );
+        return s.storage->Put( std::move( value ), key );
+    }
+    virtual ThisType* Clone() const {
+        ThisType* tt = new ThisType;
+        LockAll();
+        try {
+            for( std::size_t i = 0; i != N; ++i ) {
+                StorageType* c = shards_[ i ].storage->Clone();
+                delete tt->shards_[ i ].storage;
+                tt->shards_[ i ].storage = c;
+            }
+        } catch( ... ) {
+            UnlockAll();
+            delete tt;
+            throw;
+        }
+        UnlockAll();
+        return tt;
+    }
+    virtual const std::type_info& KeyType() const { return typeid( Key ); }
+    virtual void Visit( const Visitor& visitor ) const {
+        std::vector< std::pair< Any, Any > > entries;
+        for( std::size_t i = 0; i != N; ++i ) {
+            entries.clear();
+            {
+                boost::lock_guard< MutexType > lock( shards_[ i ].mutex );
+                shards_[ i ].storage->Visit( [ &entries ]( const Any& k, const Any& v ) {
+                    entries.push_back( std::make_pair( k, v ) );
+                } );
+            }
+            for( std::size_t e = 0; e != entries.size(); ++e )
+                visitor( entries[ e ].first, entries[ e ].second );
+        }
+    }
+    /// Number of stored elements, requires @c AnyStorageT::Size().
+    std::size_t Size() const {
+        std::size_t n = 0;
+        LockAll();
+        for( std::size_t i = 0; i != N; ++i ) n += shards_[ i ].storage->Size();
+        UnlockAll();
+        return n;
+    }
+    /// Index of shard storing @c key.
+    static std::size_t ShardOf( const Any& key ) {
+        //high bits used to select shard, so that storages using the low bits
+        //of the same hash, like HashAnyStorage, still get distinct values
+        //within a shard
+        return std::size_t( ( AnyMixedHash( key ) >> 32 ) % N );
+    }
+    ~ShardedAnyStorage() {
+        for( std::size_t i = 0; i != N; ++i ) delete shards_[ i ].storage;
+    }
+private:
+    void LockAll() const {
+        for( std::size_t i = 0; i != N; ++i ) shards_[ i ].mutex.lock();
+    }
+    void UnlockAll() const {
+        for( std::size_t i = N; i != 0; --i ) shards_[ i - 1 ].mutex.unlock();
+    }
+    /// Padding keeps the mutex and storage pointer of consecutive shards on
+    /// different cache lines.
+    struct Shard {
+        mutable MutexType mutex;
+        StorageType* storage;
+        char padding[ CACHE_LINE_SIZE ];
+    };
+    Shard shards_[ N ];
+};
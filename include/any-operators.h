@@ -4,15 +4,112 @@
 
 #include <string>
 #include <stdexcept>
+#include <typeinfo>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <tuple>
+#include <array>
+#include <vector>
+#include <deque>
+#include <list>
+#include <forward_list>
+#include <set>
+#include <map>
+#include <unordered_set>
+#include <unordered_map>
 
 /// \defgroup any_ops Any 
 /// @{
 
-    /// \defgroup lt lower than
+    /// \defgroup detect Operator detection
     /// @{
 
+/// Value is @c true if @c TraitT< E >::Value is @c true for all the
+/// element types @c E of @c T: operators of standard containers, pairs and
+/// tuples are declared for any element type, and are usable only if the
+/// operators of the elements are. @c true for other types.
+template < template < typename > class TraitT, typename T >
+struct AnyElementsHave {
+    enum { Value = true };
+};
+
+template < template < typename > class TraitT, typename... Ts >
+struct AnyAllHave {
+    enum { Value = true };
+};
+
+template < template < typename > class TraitT, typename T, typename... Ts >
+struct AnyAllHave< TraitT, T, Ts... > {
+    enum { Value = TraitT< T >::Value && AnyAllHave< TraitT, Ts... >::Value };
+};
+
+template < template < typename > class TraitT, typename T1, typename T2 >
+struct AnyElementsHave< TraitT, std::pair< T1, T2 > > : AnyAllHave< TraitT, T1, T2 > {};
+template < template < typename > class TraitT, typename... Ts >
+struct AnyElementsHave< TraitT, std::tuple< Ts... > > : AnyAllHave< TraitT, Ts... > {};
+template < template < typename > class TraitT, typename T, std::size_t N >
+struct AnyElementsHave< TraitT, std::array< T, N > > : AnyAllHave< TraitT, T > {};
+template < template < typename > class TraitT, typename T, typename A >
+struct AnyElementsHave< TraitT, std::vector< T, A > > : AnyAllHave< TraitT, T > {};
+template < template < typename > class TraitT, typename T, typename A >
+struct AnyElementsHave< TraitT, std::deque< T, A > > : AnyAllHave< TraitT, T > {};
+template < template < typename > class TraitT, typename T, typename A >
+struct AnyElementsHave< TraitT, std::list< T, A > > : AnyAllHave< TraitT, T > {};
+template < template < typename > class TraitT, typename T, typename A >
+struct AnyElementsHave< TraitT, std::forward_list< T, A > > : AnyAllHave< TraitT, T > {};
+template < template < typename > class TraitT, typename K, typename C, typename A >
+struct AnyElementsHave< TraitT, std::set< K, C, A > > : AnyAllHave< TraitT, K > {};
+template < template < typename > class TraitT, typename K, typename C, typename A >
+struct AnyElementsHave< TraitT, std::multiset< K, C, A > > : AnyAllHave< TraitT, K > {};
+template < template < typename > class TraitT, typename K, typename V, typename C, typename A >
+struct AnyElementsHave< TraitT, std::map< K, V, C, A > > : AnyAllHave< TraitT, K, V > {};
+template < template < typename > class TraitT, typename K, typename V, typename C, typename A >
+struct AnyElementsHave< TraitT, std::multimap< K, V, C, A > > : AnyAllHave< TraitT, K, V > {};
+template < template < typename > class TraitT, typename K, typename H, typename E, typename A >
+struct AnyElementsHave< TraitT, std::unordered_set< K, H, E, A > > : AnyAllHave< TraitT, K > {};
+template < template < typename > class TraitT, typename K, typename H, typename E, typename A >
+struct AnyElementsHave< TraitT, std::unordered_multiset< K, H, E, A > > : AnyAllHave< TraitT, K > {};
+template < template < typename > class TraitT, typename K, typename V, typename H, typename E, typename A >
+struct AnyElementsHave< TraitT, std::unordered_map< K, V, H, E, A > > : AnyAllHave< TraitT, K, V > {};
+template < template < typename > class TraitT, typename K, typename V, typename H, typename E, typename A >
+struct AnyElementsHave< TraitT, std::unordered_multimap< K, V, H, E, A > > : AnyAllHave< TraitT, K, V > {};
+
+/// Value is @c true if @c operator< is defined for type @c T; standard
+/// containers, pairs and tuples are also checked through their element
+/// types, see AnyElementsHave.
+template < typename T >
+struct AnyHasLess {
+    template < typename U > static auto Test( int )
+        -> decltype( std::declval< const U& >() < std::declval< const U& >(), std::true_type() );
+    template < typename U > static std::false_type Test( ... );
+    enum { Value = decltype( Test< T >( 0 ) )::value && AnyElementsHave< AnyHasLess, T >::Value };
+};
+
+/// Value is @c true if @c operator== is defined for type @c T; standard
+/// containers, pairs and tuples are also checked through their element
+/// types, see AnyElementsHave.
 template < typename T >
-struct AnyLt {
+struct AnyHasEqual {
+    template < typename U > static auto Test( int )
+        -> decltype( std::declval< const U& >() == std::declval< const U& >(), std::true_type() );
+    template < typename U > static std::false_type Test( ... );
+    enum { Value = decltype( Test< T >( 0 ) )::value && AnyElementsHave< AnyHasEqual, T >::Value };
+};
+
+/// Base of the default operator implementations which throw at run-time.
+struct AnyOpNotImplemented {};
+
+/// @}
+
+    /// \defgroup lt lower than
+    /// @{
+
+/// Default implementation: uses @c operator< if available, throws
+/// @c std::runtime_error otherwise.
+template < typename T, bool = AnyHasLess< T >::Value >
+struct AnyLt : AnyOpNotImplemented {
     static bool Op( const T&, const T& ) {
 	throw std::runtime_error( std::string( "AnyLess not implemented for type " ) + typeid( T ).name() );
 	return false;
@@ -20,36 +117,47 @@ struct AnyLt {
 };
 
 template < typename T >
-struct AnyLt< T* > {
-    static bool Op( const T* p1, const T* p2) {
-	return p1 < p2;
+struct AnyLt< T, true > {
+    static bool Op( const T& v1, const T& v2 ) {
+	return v1 < v2;
     }
 };
 
 template < typename T > bool AnyLess( const T& v1, const T& v2 ) { return AnyLt< T >::Op( v1, v2 ); }
-bool AnyLess( char v1, char v2 ) { return v1 < v2; }
-bool AnyLess( unsigned char v1, unsigned char v2 ) { return v1 < v2; }
-bool AnyLess( short v1, short v2 ) { return v1 < v2; }
-bool AnyLess( unsigned short v1, unsigned short v2 ) { return v1 < v2; }
-bool AnyLess( int v1, int v2 ) { return v1 < v2; }
-bool AnyLess( unsigned int v1, unsigned int v2 ) { return v1 < v2; }
-bool AnyLess( long v1, long v2 ) { return v1 < v2; }
-bool AnyLess( unsigned long v1, unsigned long v2 ) { return v1 < v2; }
-bool AnyLess( long long v1, long long v2 ) { return v1 < v2; }
-bool AnyLess( unsigned long long v1, unsigned long long v2 ) { return v1 < v2; }
-bool AnyLess( float v1, float v2 ) { return v1 < v2; }
-bool AnyLess( double v1, double v2 ) { return v1 < v2; }
-bool AnyLess( const std::string& v1, const std::string& v2 ) { return v1 < v2; }
-bool AnyLess( const std::wstring& v1, const std::wstring& v2 ) { return v1 < v2; }
-bool AnyLess( const void* v1, const void* v2 ) { return v1 < v2; }
+inline bool AnyLess( bool v1, bool v2 ) { return v1 < v2; }
+inline bool AnyLess( char v1, char v2 ) { return v1 < v2; }
+inline bool AnyLess( unsigned char v1, unsigned char v2 ) { return v1 < v2; }
+inline bool AnyLess( short v1, short v2 ) { return v1 < v2; }
+inline bool AnyLess( unsigned short v1, unsigned short v2 ) { return v1 < v2; }
+inline bool AnyLess( int v1, int v2 ) { return v1 < v2; }
+inline bool AnyLess( unsigned int v1, unsigned int v2 ) { return v1 < v2; }
+inline bool AnyLess( long v1, long v2 ) { return v1 < v2; }
+inline bool AnyLess( unsigned long v1, unsigned long v2 ) { return v1 < v2; }
+inline bool AnyLess( long long v1, long long v2 ) { return v1 < v2; }
+inline bool AnyLess( unsigned long long v1, unsigned long long v2 ) { return v1 < v2; }
+inline bool AnyLess( float v1, float v2 ) { return v1 < v2; }
+inline bool AnyLess( double v1, double v2 ) { return v1 < v2; }
+inline bool AnyLess( const std::string& v1, const std::string& v2 ) { return v1 < v2; }
+inline bool AnyLess( const std::wstring& v1, const std::wstring& v2 ) { return v1 < v2; }
+inline bool AnyLess( const void* v1, const void* v2 ) { return v1 < v2; }
+
+/// Value is @c true if values of type @c T can be ordered through
+/// @c AnyLess: @c operator< is defined or @c AnyLt is specialized; specialize
+/// for types ordered by a non-template @c AnyLess overload only.
+template < typename T >
+struct AnyIsOrdered {
+    enum { Value = !std::is_base_of< AnyOpNotImplemented, AnyLt< T > >::value };
+};
 
 /// @}
 
     /// \defgroup eq Equal
     /// {@
 
-template < typename T >
-struct AnyEq {
+/// Default implementation: uses @c operator== if available, throws
+/// @c std::runtime_error otherwise.
+template < typename T, bool = AnyHasEqual< T >::Value >
+struct AnyEq : AnyOpNotImplemented {
     static bool Op( const T&, const T& ) {
 	throw std::runtime_error( std::string( "AnyEqual not implemented for type " ) + typeid( T ).name() );
 	return false;
@@ -57,28 +165,111 @@ struct AnyEq {
 };
 
 template < typename T >
-struct AnyEq< T* > {
-    static bool Op( const T* p1, const T* p2) {
-	return p1 == p2;
+struct AnyEq< T, true > {
+    static bool Op( const T& v1, const T& v2 ) {
+	return v1 == v2;
     }
 };
 
 template < typename T > bool AnyEqual( const T& v1, const T& v2 ) { return AnyEq< T >::Op( v1, v2 ); }
-bool AnyEqual( char v1, char v2 ) { return v1 == v2; }
-bool AnyEqual( unsigned char v1, unsigned char v2 ) { return v1 == v2; }
-bool AnyEqual( short v1, short v2 ) { return v1 == v2; }
-bool AnyEqual( unsigned short v1, unsigned short v2 ) { return v1 == v2; }
-bool AnyEqual( int v1, int v2 ) { return v1 == v2; }
-bool AnyEqual( unsigned int v1, unsigned int v2 ) { return v1 == v2; }
-bool AnyEqual( long v1, long v2 ) { return v1 == v2; }
-bool AnyEqual( unsigned long v1, unsigned long v2 ) { return v1 == v2; }
-bool AnyEqual( long long v1, long long v2 ) { return v1 == v2; }
-bool AnyEqual( unsigned long long v1, unsigned long long v2 ) { return v1 == v2; }
-bool AnyEqual( float v1, float v2 ) { return v1 == v2; }
-bool AnyEqual( double v1, double v2 ) { return v1 == v2; }
-bool AnyEqual( const std::string& v1, const std::string& v2 ) { return v1 == v2; }
-bool AnyEqual( const std::wstring& v1, const std::wstring& v2 ) { return v1 == v2; }
-bool AnyEqual( const void* v1, const void* v2 ) { return v1 == v2; }
+inline bool AnyEqual( bool v1, bool v2 ) { return v1 == v2; }
+inline bool AnyEqual( char v1, char v2 ) { return v1 == v2; }
+inline bool AnyEqual( unsigned char v1, unsigned char v2 ) { return v1 == v2; }
+inline bool AnyEqual( short v1, short v2 ) { return v1 == v2; }
+inline bool AnyEqual( unsigned short v1, unsigned short v2 ) { return v1 == v2; }
+inline bool AnyEqual( int v1, int v2 ) { return v1 == v2; }
+inline bool AnyEqual( unsigned int v1, unsigned int v2 ) { return v1 == v2; }
+inline bool AnyEqual( long v1, long v2 ) { return v1 == v2; }
+inline bool AnyEqual( unsigned long v1, unsigned long v2 ) { return v1 == v2; }
+inline bool AnyEqual( long long v1, long long v2 ) { return v1 == v2; }
+inline bool AnyEqual( unsigned long long v1, unsigned long long v2 ) { return v1 == v2; }
+inline bool AnyEqual( float v1, float v2 ) { return v1 == v2; }
+inline bool AnyEqual( double v1, double v2 ) { return v1 == v2; }
+inline bool AnyEqual( const std::string& v1, const std::string& v2 ) { return v1 == v2; }
+inline bool AnyEqual( const std::wstring& v1, const std::wstring& v2 ) { return v1 == v2; }
+inline bool AnyEqual( const void* v1, const void* v2 ) { return v1 == v2; }
+
+    /// @}
+
+    /// \defgroup cmp Compare
+    /// {@
+
+/// Three-way comparison, default implementation invokes @c AnyLess twice;
+/// specialize or overload @c AnyCompare to compare with a single operation.
+template < typename T >
+struct AnyCmp {
+    static int Op( const T& v1, const T& v2 ) {
+	return AnyLess( v1, v2 ) ? -1 : ( AnyLess( v2, v1 ) ? 1 : 0 );
+    }
+};
+
+template < typename T >
+struct AnyCmp< T* > {
+    static int Op( const T* p1, const T* p2 ) {
+	return p1 < p2 ? -1 : ( p2 < p1 ? 1 : 0 );
+    }
+};
+
+template < typename T > int AnyCompare( const T& v1, const T& v2 ) { return AnyCmp< T >::Op( v1, v2 ); }
+inline int AnyCompare( bool v1, bool v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+inline int AnyCompare( char v1, char v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+inline int AnyCompare( unsigned char v1, unsigned char v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+inline int AnyCompare( short v1, short v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+inline int AnyCompare( unsigned short v1, unsigned short v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+inline int AnyCompare( int v1, int v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+inline int AnyCompare( unsigned int v1, unsigned int v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+inline int AnyCompare( long v1, long v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+inline int AnyCompare( unsigned long v1, unsigned long v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+inline int AnyCompare( long long v1, long long v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+inline int AnyCompare( unsigned long long v1, unsigned long long v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+inline int AnyCompare( float v1, float v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+inline int AnyCompare( double v1, double v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+inline int AnyCompare( const std::string& v1, const std::string& v2 ) { return v1.compare( v2 ); }
+inline int AnyCompare( const std::wstring& v1, const std::wstring& v2 ) { return v1.compare( v2 ); }
+inline int AnyCompare( const void* v1, const void* v2 ) { return ( v2 < v1 ) - ( v1 < v2 ); }
+
+    /// @}
+
+    /// \defgroup hash Hash
+    /// {@
+
+template < typename T >
+struct AnyHs {
+    static std::size_t Op( const T& ) {
+	throw std::runtime_error( std::string( "AnyHash not implemented for type " ) + typeid( T ).name() );
+	return 0;
+    }
+};
+
+template < typename T >
+struct AnyHs< T* > {
+    static std::size_t Op( const T* p ) {
+	return std::hash< const T* >()( p );
+    }
+};
+
+template < typename T > std::size_t AnyHash( const T& v ) { return AnyHs< T >::Op( v ); }
+inline std::size_t AnyHash( bool v ) { return std::hash< bool >()( v ); }
+inline std::size_t AnyHash( char v ) { return std::hash< char >()( v ); }
+inline std::size_t AnyHash( signed char v ) { return std::hash< signed char >()( v ); }
+inline std::size_t AnyHash( unsigned char v ) { return std::hash< unsigned char >()( v ); }
+inline std::size_t AnyHash( wchar_t v ) { return std::hash< wchar_t >()( v ); }
+inline std::size_t AnyHash( char16_t v ) { return std::hash< char16_t >()( v ); }
+inline std::size_t AnyHash( char32_t v ) { return std::hash< char32_t >()( v ); }
+inline std::size_t AnyHash( short v ) { return std::hash< short >()( v ); }
+inline std::size_t AnyHash( unsigned short v ) { return std::hash< unsigned short >()( v ); }
+inline std::size_t AnyHash( int v ) { return std::hash< int >()( v ); }
+inline std::size_t AnyHash( unsigned int v ) { return std::hash< unsigned int >()( v ); }
+inline std::size_t AnyHash( long v ) { return std::hash< long >()( v ); }
+inline std::size_t AnyHash( unsigned long v ) { return std::hash< unsigned long >()( v ); }
+inline std::size_t AnyHash( long long v ) { return std::hash< long long >()( v ); }
+inline std::size_t AnyHash( unsigned long long v ) { return std::hash< unsigned long long >()( v ); }
+inline std::size_t AnyHash( float v ) { return std::hash< float >()( v ); }
+inline std::size_t AnyHash( double v ) { return std::hash< double >()( v ); }
+inline std::size_t AnyHash( long double v ) { return std::hash< long double >()( v ); }
+inline std::size_t AnyHash( const std::string& v ) { return std::hash< std::string >()( v ); }
+inline std::size_t AnyHash( const std::wstring& v ) { return std::hash< std::wstring >()( v ); }
+inline std::size_t AnyHash( const void* v ) { return std::hash< const void* >()( v ); }
 
     /// @}
 
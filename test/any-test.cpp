@@ -5,12 +5,63 @@
 #include <boost/tuple/tuple.hpp>
 #include <boost/tuple/tuple_io.hpp>
 #include <iostream>
+#include <cassert>
 #include <Any.h>
+#include <AnyVisit.h>
+#include <AnyOf.h>
+#include <AnyCodec.h>
+#include <AnyView.h>
 
 
 struct Base {};
 struct Derived : Base {};
 
+// Counts live instances to check that in place and heap values are
+// destroyed exactly once.
+template < int SIZE >
+struct Counted {
+    static int count;
+    char data[ SIZE ];
+    Counted() { ++count; }
+    Counted( const Counted& ) throw() { ++count; }
+    Counted& operator=( const Counted& ) { return *this; }
+    ~Counted() { --count; }
+};
+template < int SIZE > int Counted< SIZE >::count = 0;
+template < int SIZE >
+std::ostream& operator<<( std::ostream& os, const Counted< SIZE >& ) {
+    return os << "Counted< " << SIZE << " >";
+}
+
+typedef Counted< 1 > Small;
+typedef Counted< 1024 > Large;
+
+// Counts allocations and deallocations performed through it.
+struct Point { float x, y; };
+std::ostream& operator<<( std::ostream& os, const Point& p ) {
+    return os << p.x << ' ' << p.y;
+}
+
+// Alignment larger than the one guaranteed by operator new.
+struct alignas( 64 ) Aligned { char data[ 64 ]; };
+std::ostream& operator<<( std::ostream& os, const Aligned& ) { return os; }
+
+struct CountingAllocator : DefaultAnyAllocator {
+    int allocated;
+    CountingAllocator() : allocated( 0 ) {}
+    void* Allocate( std::size_t size, std::size_t alignment ) {
+        ++allocated;
+        return DefaultAnyAllocator::Allocate( size, alignment );
+    }
+    void Deallocate( void* p, std::size_t size, std::size_t alignment ) {
+        --allocated;
+        DefaultAnyAllocator::Deallocate( p, size, alignment );
+    }
+};
+
+static_assert( std::is_nothrow_move_constructible< Any >::value, "Any must be nothrow move constructible" );
+static_assert( std::is_nothrow_move_assignable< Any >::value, "Any must be nothrow move assignable" );
+
 int main( int, char** )
 {
     Any any_int = 2;
@@ -37,6 +88,276 @@ int main( int, char** )
     typedef const boost::tuple< int, double >& TupleConstRef;
     std::cout << static_cast< TupleConstRef >( anytuple ).get< 1 >() << std::endl;
     
+    {
+        Any s1 = Small();
+        Any s2 = s1;
+        Any l1 = Large();
+        Any l2 = l1;
+        assert( Small::count == 2 && Large::count == 2 );
+        s1.Swap( l1 );
+        assert( s1.Type() == typeid( Large ) && l1.Type() == typeid( Small ) );
+        s2.Swap( l1 );
+        l1 = s1;
+        s2 = 3.0;
+        Any moved( AnyMove( s1 ) );
+        assert( moved.Type() == typeid( Large ) && s1.Empty() );
+        assert( Small::count == 0 && Large::count == 3 );
+        s1 = std::move( moved );
+        assert( s1.Type() == typeid( Large ) && moved.Empty() );
+        moved = std::move( s2 );
+        assert( moved == 3.0 && s2.Empty() );
+        std::vector< Any > va( 8, Any( 1 ) );
+        va.push_back( Small() );
+        va.push_back( Large() );
+        va.erase( va.begin() );
+        assert( Small::count == 1 && Large::count == 4 );
+    }
+    assert( Small::count == 0 && Large::count == 0 );
+    {
+        std::string str( 1000, 'x' );
+        const char* data = str.data();
+        Any astr = std::move( str );
+        assert( AnyRef< std::string >( astr ).data() == data );
+        Any astr2 = AnyMove( astr );
+        assert( AnyRef< std::string >( astr2 ).data() == data );
+        std::vector< Any > av( 1000, Any( 1 ) );
+        const Any* avdata = &av[ 0 ];
+        Any aav( std::move( av ) );
+        assert( &AnyRef< std::vector< Any > >( aav )[ 0 ] == avdata );
+    }
+    {
+        Any i = 1;
+        assert( i.TypeId() == AnyTypeIdOf< int >() );
+        assert( i.TypeId() != Any( 1L ).TypeId() );
+        assert( Any().TypeId() == AnyTypeIdOf< Any::EMPTY_ >() );
+        assert( AnyHashTypeName( typeid( int ).name() ) == AnyTypeIdOf< int >() );
+    }
+    {
+        Any d = 2.0;
+        assert( AnyCast< int >( &d ) == 0 );
+        assert( *AnyCast< double >( &d ) == 2.0 );
+        const Any* cd = &d;
+        assert( AnyCast< double >( cd ) == AnyPtr< double >( d ) );
+        assert( AnyCast< double >( static_cast< Any* >( 0 ) ) == 0 );
+        assert( AnyCheckType< double >( d ) == ANY_NO_ERROR );
+        assert( AnyCheckType< float >( d ) == ANY_TYPE_ERROR );
+        assert( AnyCheckType< float >( Any() ) == ANY_EMPTY_ERROR );
+        assert( d.Is< double >() && !d.Is< int >() && !Any().Is< int >() );
+    }
+    {
+        Any e = 1;
+        std::string& str = e.Emplace< std::string >( 100, 'x' );
+        assert( str.size() == 100 && AnyRef< std::string >( e )[ 99 ] == 'x' );
+        e.Emplace< Large >();
+        e.Emplace< Small >();
+        assert( Large::count == 0 && Small::count == 1 );
+        //heap values are moved, not copied, when a vector grows
+        std::vector< Any > v;
+        v.push_back( Large() );
+        const void* first = AnyAddress( static_cast< const Any& >( v[ 0 ] ) );
+        for( int i = 0; i != 100; ++i ) v.push_back( Large() );
+        assert( AnyAddress( static_cast< const Any& >( v[ 0 ] ) ) == first && Large::count == 101 );
+        v.clear();
+        assert( !AnyIsTriviallyCopyable( e ) && !AnyIsTriviallyCopyable( Any() ) );
+        e = Point();
+        assert( AnyIsTriviallyCopyable( e ) && AnySizeOf( e ) == sizeof( Point ) );
+        e = Aligned();
+        Any ea = e;
+        assert( reinterpret_cast< std::size_t >( AnyAddress( static_cast< const Any& >( e ) ) ) % 64 == 0 );
+        assert( reinterpret_cast< std::size_t >( AnyAddress( static_cast< const Any& >( ea ) ) ) % 64 == 0 );
+    }
+    {
+        Any l1 = Large();
+        l1.Share();
+        assert( l1.IsShared() && Large::count == 1 );
+        Any l2 = l1;
+        std::vector< Any > copies( 10, l1 );
+        assert( Large::count == 1 );
+        const Any& cl2 = l2;
+        AnyRef< Large >( cl2 );
+        assert( Large::count == 1 );
+        AnyRef< Large >( l2 );
+        assert( Large::count == 2 && l2.IsShared() );
+        AnyRef< Large >( l2 );
+        assert( Large::count == 2 );
+        l1 = Large();
+        assert( Large::count == 3 && !l1.IsShared() );
+        copies.clear();
+        assert( Large::count == 2 );
+        Any i1 = 1;
+        Any i2 = i1.Share();
+        AnyRef< int >( i2 ) = 2;
+        assert( i1 == 1 && i2 == 2 && i1 < i2 );
+        i1 = 3.0;
+        assert( !i1.IsShared() && i1 == 3.0 );
+    }
+    assert( Large::count == 0 );
+    {
+        CountingAllocator ca;
+        Any l1( Large(), ca );
+        Any l2 = l1;
+        Any s1( Small(), ca );
+        assert( ca.allocated == 2 );
+        {
+            AnyAllocatorScope scope( ca );
+            Any l3 = Large();
+            Any s2 = 1;
+            assert( ca.allocated == 3 );
+        }
+        Any l4 = Large();
+        l1.Swap( s1 );
+        assert( ca.allocated == 2 );
+        l2 = l4;
+        assert( ca.allocated == 2 );
+        l2 = 2;
+        assert( ca.allocated == 1 );
+    }
+
+    //tagged types
+    {
+        Any i1 = 1, i2 = 2, d = 2.5, b1 = false, b2 = true;
+        assert( i1 < i2 && i2 > i1 && i1 != i2 );
+        assert( AnyCompare( i2, i1 ) > 0 );
+        assert( b1 < b2 && b1 == Any( false ) );
+        Any s1 = std::string( "abc" ), s2 = std::string( "abd" );
+        assert( s1 < s2 && s1 != s2 && s1 == Any( std::string( "abc" ) ) );
+        i1 = d;
+        assert( i1.Is< double >() && i1 == 2.5 );
+        d = i2;
+        assert( d.Is< int >() && d == 2 );
+        s1 = s2;
+        assert( s1 == std::string( "abd" ) );
+        bool thrown = false;
+        try { i2 < i1; } catch( const std::logic_error& ) { thrown = true; }
+        assert( thrown );
+    }
+    //visit
+    {
+        struct Visitor {
+            int ints, strings, others;
+            Visitor() : ints( 0 ), strings( 0 ), others( 0 ) {}
+            int operator()( int& i ) { ++ints; return i; }
+            int operator()( const std::string& ) { ++strings; return -1; }
+            int operator()( const Any& ) { ++others; return -2; }
+        } v;
+        Any i = 3;
+        assert( ( AnyVisit< int, std::string >( i, v ) == 3 ) );
+        assert( ( AnyVisit< int, std::string >( Any( std::string( "s" ) ), v ) == -1 ) );
+        assert( ( AnyVisit< int, std::string >( Any( 1.0 ), v ) == -2 ) );
+        assert( ( AnyVisit< int, std::string >( Any(), v ) == -2 ) );
+        std::vector< Any > va;
+        va.push_back( 1 );
+        va.push_back( std::string( "s" ) );
+        va.push_back( 2.0f );
+        va.push_back( 2 );
+        AnyVisit< std::string, int, double >( va, v );
+        assert( v.ints == 3 && v.strings == 2 && v.others == 3 );
+    }
+    //closed set of types
+    {
+        typedef AnyOf< int, double, std::string > Value;
+        Value v1 = 2;
+        Value v2 = 3;
+        assert( v1 < v2 && v2 > v1 && v1 != v2 && AnyCompare( v1, v2 ) < 0 );
+        assert( AnyRef< int >( v1 ) == 2 && AnyVal< int >( v2 ) == 3 );
+        assert( *AnyPtr< int >( v1 ) == 2 && AnyCast< double >( &v1 ) == 0 );
+        int i = v1;
+        assert( i == 2 );
+        v1 = std::string( "abc" );
+        assert( v1.Is< std::string >() && v1 == std::string( "abc" ) );
+        assert( v1.Index() == 2 && v1.Type() == typeid( std::string ) );
+        bool thrown = false;
+        try { v1 < v2; } catch( const std::logic_error& ) { thrown = true; }
+        assert( thrown );
+        Any a = v1.ToAny();
+        assert( a == std::string( "abc" ) );
+        Value v3( a );
+        assert( v3 == v1 );
+        Value v4( std::move( v3 ) );
+        assert( v3.Empty() && v4 == v1 );
+        thrown = false;
+        try { Value v5( Any( 1.f ) ); } catch( const std::logic_error& ) { thrown = true; }
+        assert( thrown );
+        assert( Value( Any() ).Empty() );
+        v4.Swap( v2 );
+        assert( v4 == 3 && v2 == std::string( "abc" ) );
+        std::string& s = v2.Emplace< std::string >( 2, 'x' );
+        assert( s == "xx" && AnyRef< std::string >( v2 ) == "xx" );
+        const Value empty;
+        assert( !empty.Is< float >() && AnyCast< float >( &empty ) == 0 );
+    }
+    //binary codec
+    {
+        AnyCodecs().Register< Point >( ANY_CODE_USER );
+        std::vector< Any > inner;
+        inner.push_back( std::string( "abc" ) );
+        inner.push_back( Any() );
+        std::vector< Any > va;
+        va.push_back( 1 );
+        va.push_back( 2.5 );
+        va.push_back( inner );
+        va.push_back( 7ULL );
+        Point pt = { 1.f, 2.f };
+        va.push_back( pt );
+        const std::vector< char > buf = AnyEncode( va );
+        const Any d = AnyDecode( buf );
+        const std::vector< Any >& dv = AnyRef< std::vector< Any > >( d );
+        assert( dv.size() == 5 && dv[ 0 ] == 1 && dv[ 1 ] == 2.5 );
+        const std::vector< Any >& di = dv[ 2 ];
+        assert( di[ 0 ] == std::string( "abc" ) && di[ 1 ].Empty() );
+        assert( dv[ 3 ] == 7ULL );
+        assert( AnyRef< Point >( dv[ 4 ] ).y == 2.f );
+        const AnyView view( buf );
+        assert( view.Is< std::vector< Any > >() && view.Size() == 5 );
+        assert( view[ 0 ].Get< int >() == 1 && view[ 1 ] == 2.5 );
+        assert( view[ 2 ][ 0 ].Type() == typeid( std::string ) );
+        assert( view[ 2 ][ 0 ].Get< std::string >() == "abc" );
+        assert( view[ 2 ][ 1 ].Empty() && view[ 4 ].Get< Point >().x == 1.f );
+        assert( AnyRef< std::vector< Any > >( view[ 2 ].ToAny() )[ 0 ] == std::string( "abc" ) );
+        assert( view[ 0 ] < AnyView( AnyEncode( 2 ) ) );
+        assert( view[ 2 ][ 0 ] == AnyView( AnyEncode( std::string( "abc" ) ) ) );
+        assert( view[ 2 ][ 0 ] > AnyView( AnyEncode( std::string( "ab" ) ) ) );
+        assert( view[ 1 ] == AnyView( buf )[ 1 ] );
+        bool outOfRange = false;
+        try { view[ 5 ]; } catch( const std::out_of_range& ) { outOfRange = true; }
+        assert( outOfRange );
+        bool thrown = false;
+        try { AnyEncode( Any( Large() ) ); } catch( const std::logic_error& ) { thrown = true; }
+        assert( thrown );
+        thrown = false;
+        try {
+            const std::vector< char > truncated( buf.begin(), buf.end() - 1 );
+            AnyDecode( truncated );
+        } catch( const std::runtime_error& ) { thrown = true; }
+        assert( thrown );
+        thrown = false;
+        try {
+            std::vector< char > trailing( buf );
+            trailing.push_back( 0 );
+            AnyDecode( trailing );
+        } catch( const std::runtime_error& ) { thrown = true; }
+        assert( thrown );
+        thrown = false;
+        try {
+            //element count larger than the offset table
+            std::vector< char > forged( buf );
+            const unsigned int count = 0x40000000;
+            std::memcpy( &forged[ sizeof( AnyCode ) ], &count, sizeof( count ) );
+            const AnyView fv( forged );
+            fv[ 0 ];
+        } catch( const std::runtime_error& ) { thrown = true; }
+        assert( thrown );
+        Any nested = std::vector< Any >();
+        for( int i = 0; i != AnyCodecRegistry::MAX_DEPTH; ++i )
+            nested = std::vector< Any >( 1, nested );
+        const std::vector< char > deep = AnyEncode( nested );
+        thrown = false;
+        try { AnyDecode( deep ); } catch( const std::runtime_error& ) { thrown = true; }
+        assert( thrown );
+        const std::vector< char > shallow = AnyEncode( AnyRef< std::vector< Any > >( nested )[ 0 ] );
+        assert( AnyDecode( shallow ).Type() == typeid( std::vector< Any > ) );
+    }
+
     Base* pbase;
     Derived  derived; 
     pbase = &derived;
@@ -5,6 +5,10 @@
 #include <cmath>
 #include <complex>
 #include <map>
+#include <list>
+#include <tuple>
+#include <algorithm>
+#include <unordered_map>
 #define ANY_OSTREAM
 #include <Any.h>
 
@@ -20,7 +24,55 @@ bool AnyLess( const std::complex< float >& c1, const std::complex< float >& c2 )
 bool AnyEqual( const std::complex< float >& c1, const std::complex< float >& c2 ) {
     return std::abs( c1 ) == std::abs( c2 ); 
 }
+
+std::size_t AnyHash( const std::complex< float >& c ) {
+    return std::hash< float >()( std::abs( c ) ); 
+}
 }
+
+// types comparable through their own operators, no AnyLess/AnyEqual overloads
+struct Version {
+    int major, minor;
+    Version( int ma, int mi ) : major( ma ), minor( mi ) {}
+    bool operator<( const Version& v ) const {
+        return major < v.major || ( major == v.major && minor < v.minor );
+    }
+    bool operator==( const Version& v ) const {
+        return major == v.major && minor == v.minor;
+    }
+};
+std::ostream& operator<<( std::ostream& os, const Version& v ) {
+    return os << v.major << '.' << v.minor;
+}
+
+// counts comparisons
+struct Ranked {
+    int rank;
+    static int compares;
+    explicit Ranked( int r ) : rank( r ) {}
+    bool operator<( const Ranked& r ) const { ++compares; return rank < r.rank; }
+    bool operator==( const Ranked& r ) const { return rank == r.rank; }
+};
+int Ranked::compares = 0;
+std::ostream& operator<<( std::ostream& os, const Ranked& r ) { return os << r.rank; }
+
+struct Opaque {};
+std::ostream& operator<<( std::ostream& os, const Opaque& ) { return os; }
+
+static_assert( AnyIsOrdered< Version >::Value, "Version must be ordered" );
+static_assert( AnyIsOrdered< std::vector< int > >::Value, "vector<int> must be ordered" );
+static_assert( !AnyIsOrdered< Opaque >::Value, "Opaque must not be ordered" );
+static_assert( !AnyIsOrdered< std::vector< Opaque > >::Value, "vector<Opaque> must not be ordered" );
+static_assert( !AnyIsOrdered< std::pair< int, Opaque > >::Value, "pair<int, Opaque> must not be ordered" );
+static_assert( !AnyIsOrdered< std::list< Opaque > >::Value, "list<Opaque> must not be ordered" );
+static_assert( !AnyIsOrdered< std::map< int, Opaque > >::Value, "map<int, Opaque> must not be ordered" );
+static_assert( !AnyIsOrdered< std::tuple< int, std::vector< Opaque > > >::Value, "tuple must not be ordered" );
+static_assert( !AnyHasEqual< std::unordered_map< int, Opaque > >::Value, "unordered_map<int, Opaque> has no ==" );
+static_assert( AnyIsOrdered< std::map< int, std::pair< Version, std::string > > >::Value, "map must be ordered" );
+std::ostream& operator<<( std::ostream& os, const std::pair< int, Opaque >& ) { return os; }
+std::ostream& operator<<( std::ostream& os, const std::list< Opaque >& ) { return os; }
+std::ostream& operator<<( std::ostream& os, const std::tuple< int, Opaque >& ) { return os; }
+
 Any AnyGen() { return 3.0; }
 
 int main( int, char** )
@@ -59,6 +111,62 @@ int main( int, char** )
         anyMap[ 3 ] = std::string( "hey" );
         assert( anyMap[ 3 ] == std::string( "hey" ) );
 
+        assert( AnyCompare( Any( 2 ), Any( 3 ) ) < 0 );
+        assert( AnyCompare( Any( 3 ), Any( 3 ) ) == 0 );
+        assert( AnyCompare( Any( std::string( "b" ) ), Any( std::string( "a" ) ) ) > 0 );
+        assert( AnyCompare( any2, any1 ) > 0 );
+        std::vector< Any > sorted;
+        sorted.push_back( 3 );
+        sorted.push_back( 1 );
+        sorted.push_back( 2 );
+        std::sort( sorted.begin(), sorted.end() );
+        assert( sorted[ 0 ] == 1 && sorted[ 1 ] == 2 && sorted[ 2 ] == 3 );
+        //one AnyLess call per ordering, as with the contained type
+        Ranked::compares = 0;
+        assert( !( Any( Ranked( 1 ) ) < Any( Ranked( 1 ) ) ) );
+        assert( Ranked::compares == 1 );
+        std::map< Any, int > rankedAny;
+        std::map< Ranked, int > ranked;
+        for( int i = 0; i != 64; ++i ) {
+            rankedAny[ Ranked( i * 7 % 64 ) ] = i;
+            ranked[ Ranked( i * 7 % 64 ) ] = i;
+        }
+        Ranked::compares = 0;
+        for( int i = 0; i != 64; ++i ) assert( rankedAny.find( Ranked( i ) ) != rankedAny.end() );
+        const int anyCompares = Ranked::compares;
+        Ranked::compares = 0;
+        for( int i = 0; i != 64; ++i ) assert( ranked.find( Ranked( i ) ) != ranked.end() );
+        assert( anyCompares == Ranked::compares );
+
+        assert( Any( Version( 1, 2 ) ) < Any( Version( 1, 3 ) ) );
+        assert( Any( Version( 1, 2 ) ) == Any( Version( 1, 2 ) ) );
+        assert( AnyCompare( Any( Version( 2, 0 ) ), Any( Version( 1, 9 ) ) ) > 0 );
+        bool thrown = false;
+        try { Any( Opaque() ) < Any( Opaque() ); } catch( const std::runtime_error& ) { thrown = true; }
+        assert( thrown );
+        //containers of types without operators compile and throw when compared
+        thrown = false;
+        try { Any( std::pair< int, Opaque >() ) < Any( std::pair< int, Opaque >() ); } catch( const std::runtime_error& ) { thrown = true; }
+        assert( thrown );
+        thrown = false;
+        try { Any( std::list< Opaque >() ) == Any( std::list< Opaque >() ); } catch( const std::runtime_error& ) { thrown = true; }
+        assert( thrown );
+        thrown = false;
+        try { Any( std::tuple< int, Opaque >() ) < Any( std::tuple< int, Opaque >() ); } catch( const std::runtime_error& ) { thrown = true; }
+        assert( thrown );
+
+        typedef std::unordered_map< Any, Any > AnyHashMap;
+        AnyHashMap anyHashMap;
+        anyHashMap[ 5 ] = 10.;
+        anyHashMap[ 3 ] = std::string( "hey" );
+        assert( anyHashMap[ 5 ] == 10. );
+        assert( anyHashMap.find( 4 ) == anyHashMap.end() );
+        assert( std::hash< Any >()( std::string( "hey" ) )
+                == std::hash< std::string >()( "hey" ) );
+        assert( AnyHash( Any( std::complex< float >( 1.f, 0.f ) ) )
+                == AnyHash( Any( std::complex< float >( 0.f, 1.f ) ) ) );
+        assert( AnyHash( Any() ) == 0 );
+
         Any any3( AnyMove( AnyGen() ) );
         assert( any3 == 3.0 );
         std::cout << "OK" << std::endl;
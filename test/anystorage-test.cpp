@@ -6,11 +6,27 @@
 #include <complex>
 #include <map>
 #include <string>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
 
 #define ANY_OSTREAM
+#define ANY_STATIC_KEY_CHECK
 
 #include <Any.h>
 #include <AnyStorage.h>
+#include <HashAnyStorage.h>
+#include <SSTableAnyStorage.h>
+#include <LogAnyStorage.h>
+#include <AnyCheckpoint.h>
+#include <ShardedAnyStorage.h>
+#include <SeqLockAnyStorage.h>
+
+// Trivially copyable value larger than the Any buffer.
+struct Quote { double bid, ask; long long time; int size[ 4 ]; };
+std::ostream& operator<<( std::ostream& os, const Quote& q ) {
+    return os << q.bid << ' ' << q.ask;
+}
 
 
 int main( int, char** )
@@ -31,6 +47,8 @@ int main( int, char** )
         assert( ms->Get( k2 ) == std::string( "321" ) );
         ms->Put( 321, k1 );
         assert( ms->Get( k1 ) == 321 );
+        ms->Put( 5, Key( 2 ) );
+        assert( ms->Get( Key( 2 ) ) == 5 );
         }
         {
         boost::intrusive_ptr< MapAnyStorage > ms = new MapAnyStorage;
@@ -42,6 +60,17 @@ int main( int, char** )
         assert( ms->Get( k1 ) == 321 );
         }
         {
+        boost::intrusive_ptr< MapAnyStorage > ms = new MapAnyStorage;
+        Any v = std::vector< Any >( 1000, Any( 1 ) );
+        ms->Put( std::move( v.Share() ), 1 );
+        boost::intrusive_ptr< MapAnyStorage > mc = ms->Clone();
+        assert( AnyAddress( ms->Get( 1 ) ) == AnyAddress( mc->Get( 1 ) ) );
+        Any& cv = const_cast< Any& >( mc->Get( 1 ) );
+        AnyRef< std::vector< Any > >( cv )[ 0 ] = 2;
+        assert( AnyAddress( ms->Get( 1 ) ) != AnyAddress( mc->Get( 1 ) ) );
+        assert( AnyRef< std::vector< Any > >( ms->Get( 1 ) )[ 0 ] == 1 );
+        }
+        {
         typedef SyncAnyStorage< MapAnyStorage > Storage;
         boost::intrusive_ptr< Storage > ms = new Storage;
         const Any k1 = ms->Put( 123, 1 );
@@ -50,6 +79,383 @@ int main( int, char** )
         assert( ms->Get( k2 ) == std::string( "321" ) );
         ms->Put( 321, k1 );
         assert( ms->Get( k1 ) == 321 );
+        const Any k3 = ms->Emplace< std::string >( 7, 3, 'a' );
+        assert( ms->Get( k3 ) == std::string( "aaa" ) );
+        boost::intrusive_ptr< Storage > mc = ms->Clone();
+        mc->Put( 0, k1 );
+        assert( ms->Get( k1 ) == 321 );
+        assert( mc->Get( k3 ) == std::string( "aaa" ) );
+        }
+        {
+        typedef RWSyncAnyStorage< MapAnyStorage > Storage;
+        boost::intrusive_ptr< Storage > ms = new Storage;
+        assert( reinterpret_cast< std::size_t >( ms.get() ) % AnyRWMutex::CACHE_LINE_SIZE == 0 );
+        boost::thread_group readers;
+        for( int t = 0; t != 4; ++t )
+            readers.create_thread( [ ms ]() {
+                for( int i = 0; i != 1000; ++i ) {
+                    const Any& v = ms->Get( i % 100 );
+                    assert( v.Empty() || v == 2 * ( i % 100 ) );
+                }
+            } );
+        for( int i = 0; i != 100; ++i ) ms->Put( 2 * i, i );
+        readers.join_all();
+        assert( ms->Get( 9 ) == 18 );
+        boost::intrusive_ptr< Storage > mc = ms->Clone();
+        mc->Put( 0, 9 );
+        assert( ms->Get( 9 ) == 18 );
+        assert( mc->Get( 9 ) == 0 );
+        }
+        {
+        boost::intrusive_ptr< HashAnyStorage > hs = new HashAnyStorage;
+        const Any k1 = hs->Put( 123, 1 );
+        const Any k2 = hs->Put( std::string( "321" ), std::string( "k" ) );
+        assert( hs->Get( k1 ) == 123 );
+        assert( hs->Get( k2 ) == std::string( "321" ) );
+        hs->Put( 321, k1 );
+        assert( hs->Get( k1 ) == 321 );
+        assert( hs->Get( 1L ).Empty() );
+        assert( hs->Get( 2 ).Empty() );
+        for( int i = 0; i != 1000; ++i ) hs->Put( 2 * i, i );
+        assert( hs->Size() == 1001 );
+        for( int i = 0; i != 1000; ++i ) assert( hs->Get( i ) == 2 * i );
+        assert( hs->Get( k2 ) == std::string( "321" ) );
+        boost::intrusive_ptr< HashAnyStorage > hc = hs->Clone();
+        hc->Put( 0, 999 );
+        assert( hs->Get( 999 ) == 1998 );
+        assert( hc->Get( 999 ) == 0 );
+        }
+        {
+        boost::intrusive_ptr< MultiAnyStorage > ms = new MultiAnyStorage;
+        ms->Put( 1 );
+        ms->Put( std::string( "two" ) );
+        ms->Put( std::vector< Any >( 3, Any( 3.0 ) ) );
+        ms->Snapshot( "anystorage-test-multi.snapshot" );
+        boost::intrusive_ptr< MultiAnyStorage > ls = MultiAnyStorage::Open( "anystorage-test-multi.snapshot" );
+        assert( ls->Get( MultiAnyStorage::Key( 1 ) ) == std::string( "two" ) );
+        ls->Put( 4, MultiAnyStorage::Key( 0 ) );
+        const MultiAnyStorage::Key k = ls->Put( 5 );
+        assert( k == 3 );
+        ls->Snapshot( "anystorage-test-multi2.snapshot" );
+        boost::intrusive_ptr< MultiAnyStorage > ls2 = MultiAnyStorage::Open( "anystorage-test-multi2.snapshot" );
+        ls2->Preload( 2 );
+        assert( ls2->Get( MultiAnyStorage::Key( 0 ) ) == 4 );
+        assert( ls2->Get( MultiAnyStorage::Key( 1 ) ) == std::string( "two" ) );
+        assert( AnyRef< std::vector< Any > >( ls2->Get( MultiAnyStorage::Key( 2 ) ) )[ 2 ] == 3.0 );
+        assert( ls2->Get( MultiAnyStorage::Key( 3 ) ) == 5 );
+        ls = 0;
+        ls2 = 0;
+        std::remove( "anystorage-test-multi.snapshot" );
+        std::remove( "anystorage-test-multi2.snapshot" );
+        }
+        {
+        boost::intrusive_ptr< MapAnyStorage > ms = new MapAnyStorage;
+        for( int i = 0; i != 100; ++i ) ms->Put( 2 * i, i );
+        ms->Snapshot( "anystorage-test-map.snapshot" );
+        boost::intrusive_ptr< MapAnyStorage > ls = MapAnyStorage::Open( "anystorage-test-map.snapshot" );
+        assert( ls->Get( 10 ) == 20 );
+        assert( ls->Get( 1000 ).Empty() );
+        ls->Put( -1, 10 );
+        ls->Put( 500, 500 );
+        assert( ls->Get( 10 ) == -1 );
+        int visited = 0, prev = -1;
+        ls->Visit( [ &visited, &prev ]( const Any& k, const Any& v ) {
+            assert( int( k ) > prev && int( v ) == ( k == 10 ? -1 : k == 500 ? 500 : 2 * int( k ) ) );
+            prev = k;
+            ++visited;
+        } );
+        assert( visited == 101 );
+        assert( ls->Size() == 101 );
+        boost::intrusive_ptr< MapAnyStorage > lc = ls->Clone();
+        assert( lc->Size() == 101 );
+        //keys already shadowing and newly shadowing snapshot keys
+        lc->Put( -2, 10 );
+        lc->Put( -3, 12 );
+        assert( lc->Size() == 101 && ls->Size() == 101 );
+        assert( lc->Get( 99 ) == 198 && lc->Get( 500 ) == 500 );
+        ls->Snapshot( "anystorage-test-map2.snapshot" );
+        boost::intrusive_ptr< MapAnyStorage > ls2 = MapAnyStorage::Open( "anystorage-test-map2.snapshot" );
+        ls2->Preload( 4 );
+        for( int i = 0; i != 100; ++i ) assert( ls2->Get( i ) == ( i == 10 ? -1 : 2 * i ) );
+        assert( ls2->Get( 500 ) == 500 );
+        //clone while slots are being decoded by another thread
+        boost::intrusive_ptr< MapAnyStorage > ls3 = MapAnyStorage::Open( "anystorage-test-map2.snapshot" );
+        boost::thread reader( [ ls3 ]() { for( int i = 0; i != 100; ++i ) ls3->Get( i ); } );
+        for( int c = 0; c != 10; ++c ) {
+            boost::intrusive_ptr< MapAnyStorage > l3c = ls3->Clone();
+            assert( l3c->Get( 99 ) == 198 && l3c->Get( 10 ) == -1 );
+        }
+        reader.join();
+        ls = 0;
+        lc = 0;
+        ls2 = 0;
+        ls3 = 0;
+        std::remove( "anystorage-test-map.snapshot" );
+        std::remove( "anystorage-test-map2.snapshot" );
+        }
+        {
+        boost::intrusive_ptr< HashAnyStorage > hs = new HashAnyStorage;
+        for( int i = 0; i != 1000; ++i ) {
+            std::ostringstream os;
+            os << "key" << i;
+            hs->Put( i, os.str() );
+        }
+        SSTableAnyStorage::Build( "anystorage-test.sst", *hs, 512 );
+        boost::intrusive_ptr< SSTableAnyStorage > ss = SSTableAnyStorage::Open( "anystorage-test.sst" );
+        boost::intrusive_ptr< SSTableAnyStorage > sc = SSTableAnyStorage::Open( "anystorage-test.sst", 4 );
+        assert( ss->Size() == 1000 );
+        for( int i = 0; i < 1000; i += 7 ) {
+            std::ostringstream os;
+            os << "key" << i;
+            assert( ss->Get( os.str() ) == i );
+            assert( sc->Get( os.str() ) == i );
+        }
+        assert( ss->Get( std::string( "key" ) ).Empty() );
+        assert( ss->Get( std::string( "zzz" ) ).Empty() );
+        assert( sc->Get( std::string( "key5000" ) ).Empty() );
+        //references from distinct instances and threads do not alias
+        const Any& r1 = ss->Get( std::string( "key1" ) );
+        const Any& r2 = sc->Get( std::string( "key2" ) );
+        const Any* r3 = 0;
+        boost::thread( [ ss, &r3 ]() { r3 = &ss->Get( std::string( "key3" ) ); assert( *r3 == 3 ); } ).join();
+        assert( r1 == 1 && r2 == 2 && &r1 != r3 );
+        //the value of the calling thread is replaced by the next Get
+        assert( &ss->Get( std::string( "key4" ) ) == &r1 && r1 == 4 );
+        int n = 0;
+        std::string last;
+        ss->Visit( [ &n, &last ]( const Any& k, const Any& ) {
+            assert( last < AnyRef< std::string >( k ) );
+            last = AnyRef< std::string >( k );
+            ++n;
+        } );
+        assert( n == 1000 );
+        bool thrown = false;
+        try { ss->Put( 1, 1 ); } catch( const std::logic_error& ) { thrown = true; }
+        assert( thrown );
+        ss = 0;
+        sc = 0;
+        std::remove( "anystorage-test.sst" );
+        }
+        {
+        const std::string dir = "anystorage-test-log";
+        {
+        boost::intrusive_ptr< LogAnyStorage > ls = new LogAnyStorage( dir, 4096, false, false );
+        for( int r = 0; r != 2; ++r )
+            for( int i = 0; i != 100; ++i ) ls->Put( i * 10 + r, i );
+        std::vector< std::future< void > > done;
+        for( int i = 0; i != 100; ++i ) done.push_back( ls->PutAsync( i * 10 + 2, i ) );
+        for( std::size_t i = 0; i != done.size(); ++i ) done[ i ].get();
+        ls->Put( std::string( "value" ), 500 );
+        bool thrown = false;
+        try { ls->Put( 1, std::string( "key" ) ); } catch( const std::logic_error& ) { thrown = true; }
+        assert( thrown );
+        thrown = false;
+        try { ls->Put( 1 ); } catch( const std::logic_error& ) { thrown = true; }
+        assert( thrown );
+        assert( ls->Size() == 101 );
+        const Any& g1 = ls->Get( 41 );
+        const Any& g2 = ls->Get( 42 );
+        assert( g2 == 422 && &ls->Get( 41 ) == &g1 && g1 == 412 );
+        //overwriting evicts the cached value, still referenced until next Get
+        ls->Put( 0, 41 );
+        assert( g1 == 412 && ls->Get( 41 ) == 0 );
+        ls->Put( 412, 41 );
+        assert( ls->Get( 41 ) == 412 );
+        assert( ls->Get( 1000 ).Empty() );
+        assert( ls->Segments() > 1 );
+        ls->Sync();
+        }
+        {
+        std::FILE* f = std::fopen( ( dir + "/0000000000.log" ).c_str(), "ab" );
+        std::fclose( f );
+        }
+        {
+        //torn write at the end of the last segment
+        boost::intrusive_ptr< LogAnyStorage > ls = new LogAnyStorage( dir, 4096, false, false );
+        const std::size_t segments = ls->Segments();
+        std::ostringstream os;
+        os << dir << "/" << std::string( 10 - 1, '0' ) << segments - 1 << ".log";
+        ls = 0;
+        std::FILE* f = std::fopen( os.str().c_str(), "ab" );
+        const char garbage[] = "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d";
+        std::fwrite( garbage, 1, sizeof( garbage ), f );
+        std::fclose( f );
+        ls = new LogAnyStorage( dir, 4096, false, false );
+        assert( ls->Size() == 101 );
+        assert( ls->Get( 500 ) == std::string( "value" ) );
+        for( int i = 0; i != 100; ++i ) assert( ls->Get( i ) == i * 10 + 2 );
+        ls->Roll();
+        assert( ls->Compact() );
+        assert( ls->Segments() == 2 );
+        ls->Put( -1, 5 );
+        assert( ls->Get( 5 ) == -1 );
+        }
+        {
+        //valid record with a key of a different type
+        std::vector< char > record( LogAnyStorage::HEADER_SIZE );
+        AnyEncode( std::string( "key" ), record );
+        unsigned int sizes[ 2 ] = { unsigned( record.size() - LogAnyStorage::HEADER_SIZE ), 0 };
+        AnyEncode( 1, record );
+        sizes[ 1 ] = unsigned( record.size() - LogAnyStorage::HEADER_SIZE - sizes[ 0 ] );
+        std::memcpy( &record[ 4 ], sizes, sizeof( sizes ) );
+        boost::crc_32_type crc;
+        crc.process_bytes( &record[ 4 ], record.size() - 4 );
+        const unsigned int c = crc.checksum();
+        std::memcpy( &record[ 0 ], &c, sizeof( c ) );
+        std::FILE* f = std::fopen( ( dir + "/0999999999.log" ).c_str(), "wb" );
+        std::fwrite( record.data(), 1, record.size(), f );
+        std::fclose( f );
+        }
+        {
+        boost::intrusive_ptr< LogAnyStorage > ls = new LogAnyStorage( dir );
+        assert( ls->Size() == 101 && ls->SkippedRecords() == 1 );
+        assert( ls->Get( 5 ) == -1 );
+        assert( ls->Get( 99 ) == 992 );
+        int n = 0;
+        ls->Visit( [ &n, ls ]( const Any& k, const Any& v ) {
+            assert( ls->Get( k ) == v );
+            ++n;
+        } );
+        assert( n == 101 );
+        }
+        DIR* d = ::opendir( dir.c_str() );
+        while( const dirent* e = ::readdir( d ) )
+            if( e->d_name[ 0 ] != '.' ) std::remove( ( dir + "/" + e->d_name ).c_str() );
+        ::closedir( d );
+        ::rmdir( dir.c_str() );
+        }
+        {
+        boost::intrusive_ptr< MapAnyStorage > ms = new MapAnyStorage;
+        for( int i = 0; i != 100; ++i ) ms->Put( i, i );
+        AnyCheckpointer cp( "anystorage-test.checkpoint" );
+        cp.Compact( *ms );
+        for( int i = 0; i != 10; ++i ) ms->Put( -i, i );
+        cp.Checkpoint( *ms );
+        ms->Put( std::string( "new" ), 5 );
+        ms->Put( 1000, 1000 );
+        cp.Checkpoint( *ms );
+        cp.Checkpoint( *ms );
+        assert( cp.DeltaCount() == 2 );
+        boost::intrusive_ptr< MapAnyStorage > rs = AnyCheckpointer( "anystorage-test.checkpoint" ).Restore();
+        assert( rs->Get( 1 ) == -1 );
+        assert( rs->Get( 5 ) == std::string( "new" ) );
+        assert( rs->Get( 50 ) == 50 );
+        assert( rs->Get( 1000 ) == 1000 );
+        assert( rs->TakeChanges().empty() );
+        cp.Compact();
+        assert( cp.DeltaCount() == 0 );
+        rs->Put( 7, 7 );
+        cp.Checkpoint( *rs );
+        rs = cp.Restore();
+        assert( rs->Get( 7 ) == 7 );
+        assert( rs->Get( 5 ) == std::string( "new" ) );
+        int n = 0;
+        rs->Visit( [ &n ]( const Any&, const Any& ) { ++n; } );
+        assert( n == 101 );
+        rs->Put( 8, 7 );
+        cp.Checkpoint( *rs );
+        bool thrown = false;
+        try {
+            boost::intrusive_ptr< MapAnyStorage > untracked = new MapAnyStorage;
+            cp.Compact( *untracked );
+        } catch( const std::logic_error& ) { thrown = true; }
+        assert( thrown && cp.DeltaCount() == 2 );
+        //pending change written as delta before replacing base
+        rs->Put( 9, 7 );
+        cp.Compact( *rs );
+        assert( cp.DeltaCount() == 0 && rs->TakeChanges().empty() );
+        assert( boost::intrusive_ptr< MapAnyStorage >( cp.Restore() )->Get( 7 ) == 9 );
+        rs = 0;
+        cp.Compact();
+        assert( cp.DeltaCount() == 0 );
+        std::remove( "anystorage-test.checkpoint" );
+        }
+        {
+        typedef ShardedAnyStorage< MapAnyStorage, 8 > Storage;
+        boost::intrusive_ptr< Storage > ss = new Storage;
+        boost::thread_group writers;
+        for( int t = 0; t != 4; ++t )
+            writers.create_thread( [ ss, t ]() {
+                for( int i = 0; i != 250; ++i ) ss->Put( i, t * 250 + i );
+            } );
+        writers.join_all();
+        assert( ss->Size() == 1000 );
+        for( int i = 0; i != 1000; ++i ) assert( ss->Get( i ) == i % 250 );
+        assert( ss->Get( 1000 ).Empty() );
+        boost::intrusive_ptr< Storage > sc = ss->Clone();
+        sc->Put( -1, 0 );
+        sc->Put( -1, 1000 );
+        assert( ss->Get( 0 ) == 0 );
+        assert( sc->Get( 0 ) == -1 );
+        assert( sc->Size() == 1001 );
+        int n = 0;
+        //visitor can access the storage
+        sc->Visit( [ &n, sc ]( const Any& k, const Any& v ) {
+            assert( sc->Get( k ) == v );
+            ++n;
+        } );
+        assert( n == 1001 );
+        bool thrown = false;
+        try { ss->Put( 1 ); } catch( const std::logic_error& ) { thrown = true; }
+        assert( thrown );
+        boost::intrusive_ptr< ShardedAnyStorage< HashAnyStorage > > hs = new ShardedAnyStorage< HashAnyStorage >;
+        for( int i = 0; i != 1000; ++i ) hs->Put( i, std::string( 1, char( 'a' + i % 26 ) ) + char( 'a' + i / 26 ) );
+        assert( hs->Size() == 1000 );
+        assert( hs->Get( std::string( "ba" ) ) == 1 );
+        }
+        {
+        boost::intrusive_ptr< SeqLockAnyStorage > ss = new SeqLockAnyStorage;
+        const Quote q0 = { 1.0, 2.0, 0, { 1, 1, 1, 1 } };
+        ss->Put( q0 );
+        boost::thread_group readers;
+        for( int t = 0; t != 4; ++t )
+            readers.create_thread( [ ss ]() {
+                for( int i = 0; i != 10000; ++i ) {
+                    const Quote q = ss->Read< Quote >();
+                    assert( q.ask == q.bid + 1.0 && q.size[ 3 ] == int( q.time ) + 1 );
+                }
+            } );
+        for( int i = 1; i != 1000; ++i ) {
+            const Quote q = { double( i ), double( i + 1 ), i, { i + 1, i + 1, i + 1, i + 1 } };
+            ss->Put( q );
+        }
+        readers.join_all();
+        assert( ss->Version() == 1000 );
+        assert( ss->Read< Quote >().time == 999 );
+        assert( AnyRef< Quote >( ss->Get() ).time == 999 );
+        ss->Put( std::string( "published" ) );
+        assert( ss->Get() == std::string( "published" ) );
+        const Any* cached = &ss->Get();
+        assert( &ss->Get() == cached );
+        bool thrown = false;
+        try { ss->Read< int >(); } catch( const std::exception& ) { thrown = true; }
+        assert( thrown );
+        ss->Put( 42 );
+        assert( ss->Read< int >() == 42 && ss->Get() == 42 );
+        boost::intrusive_ptr< SeqLockAnyStorage > sc = ss->Clone();
+        ss->Put( 43 );
+        assert( sc->Read< int >() == 42 && ss->Read< int >() == 43 );
+        //copies are per instance and released with it
+        std::vector< boost::intrusive_ptr< SeqLockAnyStorage > > storages;
+        std::vector< const Any* > values;
+        for( int i = 0; i != 20; ++i ) {
+            storages.push_back( new SeqLockAnyStorage );
+            storages.back()->Put( i );
+            values.push_back( &storages.back()->Get() );
+        }
+        for( int i = 0; i != 20; ++i ) assert( *values[ i ] == i );
+        boost::shared_ptr< int > p( new int( 1 ) );
+        storages[ 0 ]->Put( p );
+        assert( AnyRef< boost::shared_ptr< int > >( storages[ 0 ]->Get() ) == p );
+        storages.clear();
+        assert( p.use_count() == 1 );
+        //copies of other threads are released when they exit
+        boost::intrusive_ptr< SeqLockAnyStorage > sp = new SeqLockAnyStorage;
+        sp->Put( p );
+        boost::thread( [ sp ]() { sp->Get(); } ).join();
+        assert( p.use_count() == 2 );
+        sp = 0;
+        assert( p.use_count() == 1 );
         }
         std::cout << "OK" << std::endl;
 